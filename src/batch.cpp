@@ -0,0 +1,461 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "batch.h"
+#include "common.h"
+
+namespace micrantha {
+  namespace prep {
+    namespace batch {
+
+      namespace internal {
+
+#ifdef HAVE_IO_URING
+        /**
+         * an io_uring, set up with the raw system calls so there is no library to depend on
+         */
+        struct Ring {
+          int fd = -1;
+
+          void *sq = MAP_FAILED;
+          size_t sq_size = 0;
+          void *cq = MAP_FAILED;
+          size_t cq_size = 0;
+          struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+          size_t sqes_size = 0;
+
+          unsigned *sq_tail = nullptr;
+          unsigned *sq_mask = nullptr;
+          unsigned *sq_array = nullptr;
+          unsigned *cq_head = nullptr;
+          unsigned *cq_tail = nullptr;
+          unsigned *cq_mask = nullptr;
+          struct io_uring_cqe *cqes = nullptr;
+
+          // opcodes this kernel has
+          bool supported[IORING_OP_LAST] = {false};
+
+          // where queued lstats are written by the kernel
+          struct statx stats[Queue::DEPTH];
+
+          ~Ring() {
+            if (sqes != MAP_FAILED) {
+              munmap(sqes, sqes_size);
+            }
+            if (cq != MAP_FAILED && cq != sq) {
+              munmap(cq, cq_size);
+            }
+            if (sq != MAP_FAILED) {
+              munmap(sq, sq_size);
+            }
+            if (fd != -1) {
+              close(fd);
+            }
+          }
+
+          /**
+           * @return PREP_SUCCESS, or PREP_FAILURE if the kernel has no io_uring or does not allow it
+           */
+          int setup() {
+            struct io_uring_params params = {};
+
+            fd = static_cast<int>(syscall(__NR_io_uring_setup, Queue::DEPTH, &params));
+
+            if (fd == -1) {
+              return PREP_FAILURE;
+            }
+
+            sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+            // both rings in one mapping
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+              sq_size = cq_size = std::max(sq_size, cq_size);
+            }
+
+            sq = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+            if (sq == MAP_FAILED) {
+              return PREP_FAILURE;
+            }
+
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+              cq = sq;
+            } else {
+              cq = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+              if (cq == MAP_FAILED) {
+                return PREP_FAILURE;
+              }
+            }
+
+            sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+            sqes = static_cast<struct io_uring_sqe *>(
+                mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+
+            if (sqes == MAP_FAILED) {
+              return PREP_FAILURE;
+            }
+
+            auto sq_base = static_cast<char *>(sq);
+            auto cq_base = static_cast<char *>(cq);
+
+            sq_tail = reinterpret_cast<unsigned *>(sq_base + params.sq_off.tail);
+            sq_mask = reinterpret_cast<unsigned *>(sq_base + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned *>(sq_base + params.sq_off.array);
+            cq_head = reinterpret_cast<unsigned *>(cq_base + params.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned *>(cq_base + params.cq_off.tail);
+            cq_mask = reinterpret_cast<unsigned *>(cq_base + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<struct io_uring_cqe *>(cq_base + params.cq_off.cqes);
+
+            return probe();
+          }
+
+          // finds the opcodes the kernel has, the file system ones are fairly recent
+          int probe() {
+            std::vector<char> buf(sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+
+            auto probe = reinterpret_cast<struct io_uring_probe *>(buf.data());
+
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == -1) {
+              return PREP_FAILURE;
+            }
+
+            for (unsigned i = 0; i < probe->ops_len && i < IORING_OP_LAST; i++) {
+              supported[i] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) != 0;
+            }
+
+            return PREP_SUCCESS;
+          }
+
+          /**
+           * submits what has been put on the submission ring and waits for it to complete.  the
+           * entries are not linked, so the kernel may make them in any order.
+           * @param count the number of entries put on the ring
+           * @param complete called with the user data and result of each entry
+           * @return PREP_SUCCESS, PREP_FAILURE if the ring could not be entered, or PREP_ERROR if
+           * submitted entries may still be running as well
+           */
+          int enter(unsigned count, const std::function<void(uint64_t, int)> &complete) {
+            unsigned submitted = 0, completed = 0;
+
+            while (completed < count) {
+              auto n = syscall(__NR_io_uring_enter, fd, count - submitted, count - completed, IORING_ENTER_GETEVENTS,
+                               nullptr, 0);
+
+              if (n == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                return drain(submitted, completed, complete);
+              }
+
+              if (n > 0) {
+                submitted += static_cast<unsigned>(n);
+              }
+
+              completed += reap(complete);
+            }
+
+            return PREP_SUCCESS;
+          }
+
+          /**
+           * waits for the entries submitted before the ring failed, the kernel may still write to them
+           * @return PREP_FAILURE with errno kept once they are done, or PREP_ERROR if they could not be
+           * waited for
+           */
+          int drain(unsigned submitted, unsigned completed, const std::function<void(uint64_t, int)> &complete) {
+            int error = errno;
+            int rval = PREP_FAILURE;
+
+            completed += reap(complete);
+
+            while (completed < submitted) {
+              auto n = syscall(__NR_io_uring_enter, fd, 0, submitted - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+              if (n == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                rval = PREP_ERROR;
+                break;
+              }
+
+              completed += reap(complete);
+            }
+
+            errno = error;
+
+            return rval;
+          }
+
+          /**
+           * takes what has completed off the completion ring
+           * @return the number of entries completed
+           */
+          unsigned reap(const std::function<void(uint64_t, int)> &complete) {
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            unsigned completed = 0;
+
+            for (; head != tail; head++, completed++) {
+              auto cqe = &cqes[head & *cq_mask];
+
+              complete(cqe->user_data, cqe->res);
+            }
+
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+            return completed;
+          }
+
+          // puts an entry on the submission ring, made on the next enter
+          struct io_uring_sqe *next(unsigned index) {
+            unsigned tail = *sq_tail;
+            unsigned slot = tail & *sq_mask;
+
+            auto sqe = &sqes[slot];
+
+            memset(sqe, 0, sizeof(*sqe));
+
+            sq_array[slot] = slot;
+
+            sqe->fd = AT_FDCWD;
+            sqe->user_data = index;
+
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+            return sqe;
+          }
+        };
+
+        // the status of a file as lstat would give it
+        void to_stat(const struct statx &from, struct stat *to) {
+          *to = {};
+          to->st_dev = makedev(from.stx_dev_major, from.stx_dev_minor);
+          to->st_ino = from.stx_ino;
+          to->st_mode = from.stx_mode;
+          to->st_nlink = from.stx_nlink;
+          to->st_uid = from.stx_uid;
+          to->st_gid = from.stx_gid;
+          to->st_rdev = makedev(from.stx_rdev_major, from.stx_rdev_minor);
+          to->st_size = static_cast<off_t>(from.stx_size);
+          to->st_blksize = from.stx_blksize;
+          to->st_blocks = static_cast<blkcnt_t>(from.stx_blocks);
+          to->st_atim = {from.stx_atime.tv_sec, from.stx_atime.tv_nsec};
+          to->st_mtim = {from.stx_mtime.tv_sec, from.stx_mtime.tv_nsec};
+          to->st_ctim = {from.stx_ctime.tv_sec, from.stx_ctime.tv_nsec};
+        }
+#else
+        struct Ring {};
+#endif
+      }  // namespace internal
+
+      Queue::Queue() : failed_(false) {
+#ifdef HAVE_IO_URING
+        ring_.reset(new internal::Ring());
+
+        if (ring_->setup() != PREP_SUCCESS) {
+          ring_.reset();
+        }
+#endif
+        ops_.reserve(DEPTH);
+      }
+
+      Queue::~Queue() = default;
+
+      bool Queue::is_async() const { return ring_ != nullptr; }
+
+      void Queue::mkdir(const std::string &path, mode_t mode, const callback &done) {
+        push({MKDIR, path, "", mode, nullptr, done, 0});
+      }
+
+      void Queue::symlink(const std::string &target, const std::string &path, const callback &done) {
+        push({SYMLINK, path, target, 0, nullptr, done, 0});
+      }
+
+      void Queue::link(const std::string &from, const std::string &to, const callback &done) {
+        push({LINK, to, from, 0, nullptr, done, 0});
+      }
+
+      void Queue::unlink(const std::string &path, const callback &done) {
+        push({UNLINK, path, "", 0, nullptr, done, 0});
+      }
+
+      void Queue::rmdir(const std::string &path, const callback &done) {
+        push({RMDIR, path, "", 0, nullptr, done, 0});
+      }
+
+      void Queue::lstat(const std::string &path, struct stat *st, const callback &done) {
+        push({LSTAT, path, "", 0, st, done, 0});
+      }
+
+      void Queue::push(Operation &&op) {
+        ops_.push_back(std::move(op));
+
+        if (ops_.size() >= DEPTH) {
+          submit();
+        }
+      }
+
+      int Queue::run(Operation &op) {
+        int rval = 0;
+
+        switch (op.type) {
+          case MKDIR:
+            rval = ::mkdir(op.path.c_str(), op.mode);
+            break;
+          case SYMLINK:
+            rval = ::symlink(op.target.c_str(), op.path.c_str());
+            break;
+          case LINK:
+            rval = ::link(op.target.c_str(), op.path.c_str());
+            break;
+          case UNLINK:
+            rval = ::unlink(op.path.c_str());
+            break;
+          case RMDIR:
+            rval = ::rmdir(op.path.c_str());
+            break;
+          case LSTAT:
+            rval = ::lstat(op.path.c_str(), op.st);
+            break;
+        }
+
+        return rval == -1 ? -errno : 0;
+      }
+
+      void Queue::submit() {
+        if (ops_.empty()) {
+          return;
+        }
+
+        if (ring_ != nullptr) {
+          submit_ring();
+        } else {
+          for (auto &op : ops_) {
+            op.result = run(op);
+          }
+        }
+
+        for (auto &op : ops_) {
+          if (op.result < 0) {
+            failed_ = true;
+          }
+
+          if (op.done) {
+            op.done(op.result);
+          }
+        }
+
+        ops_.clear();
+      }
+
+      void Queue::submit_ring() {
+#ifdef HAVE_IO_URING
+        static const unsigned OPCODES[] = {IORING_OP_MKDIRAT,  IORING_OP_SYMLINKAT, IORING_OP_LINKAT,
+                                           IORING_OP_UNLINKAT, IORING_OP_UNLINKAT,  IORING_OP_STATX};
+        // not yet made
+        constexpr static const int PENDING = 1;
+
+        unsigned count = 0;
+
+        for (unsigned i = 0; i < ops_.size(); i++) {
+          auto &op = ops_[i];
+          auto opcode = OPCODES[op.type];
+
+          // this kernel can not queue it
+          if (!ring_->supported[opcode]) {
+            op.result = run(op);
+            continue;
+          }
+
+          auto sqe = ring_->next(i);
+
+          sqe->opcode = static_cast<__u8>(opcode);
+          sqe->addr = reinterpret_cast<uintptr_t>(op.path.c_str());
+
+          switch (op.type) {
+            case MKDIR:
+              sqe->len = op.mode;
+              break;
+            case SYMLINK:
+            case LINK:
+              sqe->addr = reinterpret_cast<uintptr_t>(op.target.c_str());
+              sqe->addr2 = reinterpret_cast<uintptr_t>(op.path.c_str());
+              if (op.type == LINK) {
+                sqe->len = static_cast<__u32>(AT_FDCWD);
+              }
+              break;
+            case UNLINK:
+              break;
+            case RMDIR:
+              sqe->unlink_flags = AT_REMOVEDIR;
+              break;
+            case LSTAT:
+              sqe->len = STATX_BASIC_STATS;
+              sqe->off = reinterpret_cast<uintptr_t>(&ring_->stats[i]);
+              sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+              break;
+          }
+
+          op.result = PENDING;
+          count++;
+        }
+
+        auto complete = [this](uint64_t index, int result) {
+          auto &op = ops_[index];
+
+          op.result = result;
+
+          if (result == 0 && op.type == LSTAT) {
+            internal::to_stat(ring_->stats[index], op.st);
+          }
+        };
+
+        if (count == 0) {
+          return;
+        }
+
+        // entries in one submission run unordered, callers flush between operations that depend on each other
+        int rval = ring_->enter(count, complete);
+
+        if (rval != PREP_SUCCESS) {
+          int error = errno;
+
+          // the ring is unusable, what was not made failed
+          for (auto &op : ops_) {
+            if (op.result == PENDING) {
+              op.result = -error;
+            }
+          }
+
+          if (rval == PREP_ERROR) {
+            // the kernel may still write lstats into the ring, so it is never freed
+            ring_.release();
+          } else {
+            ring_.reset();
+          }
+        }
+#endif
+      }
+
+      int Queue::flush() {
+        submit();
+
+        bool failed = failed_;
+
+        failed_ = false;
+
+        return failed ? PREP_FAILURE : PREP_SUCCESS;
+      }
+    }
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef MICRANTHA_PREP_BATCH_H
+#define MICRANTHA_PREP_BATCH_H
+
+#include <sys/stat.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace micrantha {
+  namespace prep {
+    namespace batch {
+
+      /**
+       * called when an operation is done
+       * @param result zero, or the negative errno of the operation
+       */
+      typedef std::function<void(int result)> callback;
+
+      namespace internal {
+        struct Ring;
+      }
+
+      /**
+       * queues file system operations and makes them in bulk.  where the kernel has io_uring, a flush
+       * is a single system call for the whole batch instead of one for each file.  otherwise, or for
+       * operations the kernel can not queue, they are made one at a time.
+       *
+       * operations between flushes may be made in any order, so something depending on an earlier
+       * operation (a link in a new folder) must be queued after a flush.
+       */
+      class Queue {
+       public:
+        // the most operations held before they are flushed
+        constexpr static const unsigned DEPTH = 256;
+
+        Queue();
+
+        ~Queue();
+
+        /* non-copyable */
+        Queue(const Queue &other) = delete;
+
+        Queue &operator=(const Queue &other) = delete;
+
+        /**
+         * @return true if operations are made with io_uring
+         */
+        bool is_async() const;
+
+        void mkdir(const std::string &path, mode_t mode, const callback &done = nullptr);
+
+        void symlink(const std::string &target, const std::string &path, const callback &done = nullptr);
+
+        void link(const std::string &from, const std::string &to, const callback &done = nullptr);
+
+        void unlink(const std::string &path, const callback &done = nullptr);
+
+        void rmdir(const std::string &path, const callback &done = nullptr);
+
+        /**
+         * gets the status of a file without following a symbolic link
+         * @param st set when done, and must stay valid until then
+         */
+        void lstat(const std::string &path, struct stat *st, const callback &done = nullptr);
+
+        /**
+         * makes every queued operation and waits for them, calling each callback in the order queued
+         * @return PREP_SUCCESS, or PREP_FAILURE if an operation since the last flush failed
+         */
+        int flush();
+
+       private:
+        typedef enum { MKDIR, SYMLINK, LINK, UNLINK, RMDIR, LSTAT } Type;
+
+        typedef struct {
+          Type type;
+          std::string path;
+          std::string target;
+          mode_t mode;
+          struct stat *st;
+          callback done;
+          int result;
+        } Operation;
+
+        void push(Operation &&op);
+
+        // makes the queued operations, without waiting for a full queue
+        void submit();
+
+        // makes the queued operations with io_uring
+        void submit_ring();
+
+        static int run(Operation &op);
+
+        std::vector<Operation> ops_;
+        std::unique_ptr<internal::Ring> ring_;
+        bool failed_;
+      };
+    }
+  }
+}
+
+#endif
@@ -1,17 +1,110 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
 #include <vector>
+#include <dirent.h>
 #include <unistd.h>
 #include <limits.h>
 
 #include "controller.h"
 #include "common.h"
+#include "elf_file.h"
 #include "log.h"
+#include "log_file.h"
 #include "util.h"
 #include "plugin_manager.h"
+#include "scheduler.h"
+#include "walk.h"
 
 namespace micrantha {
     namespace prep {
+        namespace internal {
+            // the seconds in a day, for saying how long a folder went unused
+            constexpr const time_t DAY = 24 * 60 * 60;
+
+            // a size to print, such as 1.5G
+            std::string to_size(uint64_t bytes) {
+                const char *unit = "BKMGT";
+                double size = bytes;
+
+                while (size >= 1024 && unit[1] != '\0') {
+                    size /= 1024;
+                    unit++;
+                }
+
+                std::ostringstream buf;
+
+                buf << std::fixed << std::setprecision(size < 10 && *unit != 'B' ? 1 : 0) << size << *unit;
+
+                return buf.str();
+            }
+
+            /**
+             * puts prep's library search path in place of the entries of a file's search path that prep
+             * owns, keeping the others, such as $ORIGIN relative folders, where they were
+             * @param current the search path of the file
+             * @param runpath the folders prep gives a package
+             * @param kitchen entries under this folder are prep's
+             * @param lib this folder is prep's too
+             */
+            std::string merge_runpath(const std::string &current, const std::string &runpath,
+                                      const std::string &kitchen, const std::string &lib) {
+                std::vector<std::string> entries;
+                bool placed = false;
+                std::istringstream in(current);
+                std::string entry;
+
+                while (std::getline(in, entry, ':')) {
+                    if (entry.empty()) {
+                        continue;
+                    }
+
+                    if (entry != lib && entry.compare(0, kitchen.length() + 1, kitchen + "/") != 0) {
+                        entries.push_back(entry);
+                    } else if (!placed) {
+                        entries.push_back(runpath);
+                        placed = true;
+                    }
+                }
+
+                // nothing there was prep's, the package's own folders are searched first
+                if (!placed) {
+                    entries.push_back(runpath);
+                }
+
+                std::string merged;
+
+                for (const auto &value : entries) {
+                    if (!merged.empty()) {
+                        merged += ":";
+                    }
+                    merged += value;
+                }
+
+                return merged;
+            }
+
+            // the order folders are collected in, builds before sources before installs
+            int collect_order(const Repository::Folder &folder) {
+                if (!strcmp(folder.kind, Repository::BUILD_FOLDER)) {
+                    return 0;
+                }
+                return strcmp(folder.kind, Repository::SOURCE_FOLDER) ? 2 : 1;
+            }
+        }
+
         Controller::Controller() = default;
 
+        Controller::~Controller() {
+            auto counts = filesystem::stat_counts();
+
+            if (counts.hits + counts.misses > 0) {
+                log::debug("path checks: ", counts.hits, " cached, ", counts.misses, " looked up");
+            }
+        }
+
         int Controller::initialize(const Options &opts) {
             if (repo_.initialize(opts)) {
                 return PREP_FAILURE;
@@ -115,7 +208,8 @@ namespace micrantha {
 
             log::trace("source[", sourcePath, "], build[", buildPath, "], install[", installPath, "]");
 
-            if (repo_.notify_plugins_build(config, sourcePath, buildPath, installPath) == PREP_FAILURE) {
+            if (repo_.notify_plugins_build(config, sourcePath, buildPath, installPath, *get_environment(config, opts)) ==
+                PREP_FAILURE) {
                 log::error("unable to build [", config.name(), "]");
                 return PREP_FAILURE;
             }
@@ -125,11 +219,13 @@ namespace micrantha {
                 return PREP_FAILURE;
             }
 
+            repo_.mark_used(config.name());
+
             return PREP_SUCCESS;
         }
 
 
-        int Controller::test_package(const Package &config, const std::string &path) {
+        int Controller::test_package(const Package &config, const Options &opts, const std::string &path) {
             std::string installPath, buildPath;
 
             if (!config.is_loaded()) {
@@ -149,7 +245,7 @@ namespace micrantha {
                 return PREP_FAILURE;
             }
 
-            if (repo_.notify_plugins_test(config, path, buildPath) == PREP_FAILURE) {
+            if (repo_.notify_plugins_test(config, path, buildPath, *get_environment(config, opts)) == PREP_FAILURE) {
                 log::error("unable to test [", config.name(), "]");
                 return PREP_FAILURE;
             }
@@ -157,7 +253,7 @@ namespace micrantha {
             return PREP_SUCCESS;
         }
 
-        int Controller::install_package(const Package &config, const std::string &path) {
+        int Controller::install_package(const Package &config, const Options &opts, const std::string &path) {
             std::string buildPath;
 
             if (!config.is_loaded()) {
@@ -177,7 +273,7 @@ namespace micrantha {
                 return PREP_FAILURE;
             }
 
-            if (repo_.notify_plugins_install(config, path, buildPath) == PREP_FAILURE) {
+            if (repo_.notify_plugins_install(config, path, buildPath, *get_environment(config, opts)) == PREP_FAILURE) {
                 log::error("unable to build [", config.name(), "]");
                 return PREP_FAILURE;
             }
@@ -210,7 +306,7 @@ namespace micrantha {
             auto buildDir = repo_.get_build_path(config.name());
 
             if (filesystem::directory_exists(buildDir) == PREP_SUCCESS) {
-                if (filesystem::remove_directory(buildDir) == PREP_FAILURE) {
+                if (repo_.discard(buildDir) == PREP_FAILURE) {
                     log::error("unable to clean ", buildDir);
                     return PREP_FAILURE;
                 }
@@ -220,6 +316,139 @@ namespace micrantha {
             return PREP_FAILURE;
         }
 
+        int Controller::gc(const Options &opts, bool automatic) {
+            const auto &budget = repo_.budget();
+
+            uint64_t available = 0;
+
+            // what has to be freed to leave the minimum free
+            uint64_t wanted = 0;
+
+            if (budget.min_free > 0 && filesystem::free_space(repo_.get_kitchen_path(), available) == PREP_SUCCESS &&
+                available < budget.min_free) {
+                wanted = budget.min_free - available;
+            }
+
+            if (automatic) {
+                if (wanted == 0) {
+                    return PREP_SUCCESS;
+                }
+                log::info("only ", internal::to_size(available), " free, collecting garbage");
+            } else if (budget.max_size == 0 && budget.max_age == 0 && budget.min_free == 0) {
+                log::info("nothing to collect, set a gc max_size, max_age or min_free in ", Repository::CONFIG_FILE);
+                return PREP_SUCCESS;
+            }
+
+            std::set<std::string> keep;
+
+            PackageConfig config;
+
+            // the package being worked on and everything it needs stay
+            if (config.load(opts.location, opts) == PREP_SUCCESS) {
+                get_graph(config, keep);
+            }
+
+            auto folders = repo_.package_folders();
+
+            uint64_t total = 0;
+
+            for (const auto &folder : folders) {
+                total += folder.size;
+            }
+
+            std::stable_sort(folders.begin(), folders.end(),
+                             [](const Repository::Folder &a, const Repository::Folder &b) {
+                                 auto diff = internal::collect_order(a) - internal::collect_order(b);
+
+                                 return diff == 0 ? a.used < b.used : diff < 0;
+                             });
+
+            // meta data always has the default package file
+            auto installed = opts;
+
+            installed.package_file = Repository::PACKAGE_FILE;
+
+            auto now = time(nullptr);
+            uint64_t freed = 0;
+            int removed = 0;
+            int rval = PREP_SUCCESS;
+
+            for (const auto &folder : folders) {
+                bool old = budget.max_age > 0 && now - folder.used > budget.max_age;
+                bool over = budget.max_size > 0 && total - freed > budget.max_size;
+
+                if (!old && !over && freed >= wanted) {
+                    continue;
+                }
+
+                if (keep.count(folder.name) > 0) {
+                    continue;
+                }
+
+                // another installed package still needs it
+                if (internal::collect_order(folder) == 2 && repo_.dependency_count(folder.name, installed) > 0) {
+                    continue;
+                }
+
+                log::info("removing ", folder.kind, " of ", color::m(folder.name), " [", internal::to_size(folder.size),
+                          "], unused for ", (now - folder.used) / internal::DAY, " days");
+
+                if (evict(folder) != PREP_SUCCESS) {
+                    rval = PREP_FAILURE;
+                    continue;
+                }
+
+                freed += folder.size;
+                removed++;
+            }
+
+            log::info("removed ", removed, " folders, ", internal::to_size(freed), " freed of ",
+                      internal::to_size(total));
+
+            return rval;
+        }
+
+        void Controller::get_graph(const Package &config, std::set<std::string> &names) const {
+            if (!names.insert(config.name()).second) {
+                return;
+            }
+
+            for (const auto &dependency : config.dependencies()) {
+                get_graph(dependency, names);
+            }
+        }
+
+        int Controller::evict(const Repository::Folder &folder) const {
+            if (!strcmp(folder.kind, Repository::SOURCE_FOLDER)) {
+                // the resolve would be reused without the source
+                ::unlink((folder.path + Repository::RESOLVE_EXT).c_str());
+            }
+
+            if (!strcmp(folder.kind, Repository::INSTALL_FOLDER) && repo_.unlink_directory(folder.path)) {
+                log::error("unable to unlink package ", folder.name);
+                return PREP_FAILURE;
+            }
+
+            if (repo_.discard(folder.path)) {
+                log::error("unable to remove ", folder.path);
+                return PREP_FAILURE;
+            }
+
+            if (strcmp(folder.kind, Repository::INSTALL_FOLDER)) {
+                return PREP_SUCCESS;
+            }
+
+            // the package would be taken as installed without it
+            auto metaDir = repo_.get_meta_path(folder.name);
+
+            if (filesystem::directory_exists(metaDir) == PREP_SUCCESS && repo_.discard(metaDir)) {
+                log::error("unable to remove meta package ", metaDir);
+                return PREP_FAILURE;
+            }
+
+            return PREP_SUCCESS;
+        }
+
         int Controller::remove(const std::string &package_name, const Options &opts) {
             std::string installDir = repo_.get_install_path(package_name);
 
@@ -242,14 +471,14 @@ namespace micrantha {
                 return PREP_FAILURE;
             }
 
-            if (filesystem::remove_directory(installDir)) {
+            if (repo_.discard(installDir)) {
                 log::error("unable to remove package ", installDir);
                 return PREP_FAILURE;
             }
 
             installDir = repo_.get_meta_path(package_name);
 
-            if (filesystem::remove_directory(installDir)) {
+            if (repo_.discard(installDir)) {
                 log::error("unable to remove meta package ", installDir);
                 return PREP_FAILURE;
             }
@@ -269,6 +498,7 @@ namespace micrantha {
 
             if (opts.force_build == ForceLevel::None && repo_.exists(config)) {
                 log::warn("used cached version of ", color::m(config.name()), " [", color::y(config.version()), "]");
+                repo_.mark_used(config.name());
                 return PREP_SUCCESS;
             }
 
@@ -288,20 +518,58 @@ namespace micrantha {
 
             log::info("preparing package ", color::m(config.name()), " [", color::y(config.version()), "]");
 
-            for (const auto &c : config.dependencies()) {
+            auto dependencies = config.dependencies();
+
+            // dependencies that need their source resolved
+            std::vector<const PackageDependency *> pending;
+
+            for (const auto &c : dependencies) {
 
                 if (opts.force_build != ForceLevel::All && repo_.exists(c)) {
                     log::info("using cached version of ", color::m(config.name()), " dependency ", color::c(c.name()),
                             " [", color::y(c.version()), "]");
+
+                    repo_.mark_used(c.name());
+
+                    if (relocate(c) != PREP_SUCCESS) {
+                        return PREP_FAILURE;
+                    }
+
+                    // an earlier isolated run stopped before linking it
+                    if (repo_.is_unlinked(c.name())) {
+                        unlinked_.push_back(repo_.get_install_path(c.name()));
+                    }
                     continue;
                 }
 
             log::info("preparing ", color::m(config.name()), " dependency ", color::c(c.name()), " [",
                     color::y(c.version()), "]");
 
-                if (get_package(c, opts, path) == PREP_FAILURE) {
+                // try to add via plugin
+                if (repo_.notify_plugins_add(c) == PREP_SUCCESS) {
+
+                    if (repo_.save_meta(c)) {
+                        log::warn("unable to save meta data for ", c.name());
+                    }
+                    continue;
+                }
+
+                pending.push_back(&c);
+            }
+
+            if (pending.size() == 1) {
+                // a lone dependency keeps the terminal for plugins that prompt
+                if (build_dependency(*pending.front(), opts, repo_.notify_plugins_resolve(*pending.front())) ==
+                    PREP_FAILURE) {
                     return PREP_FAILURE;
                 }
+            } else if (pending.size() > 1 && get_dependencies(config, opts, pending) == PREP_FAILURE) {
+                return PREP_FAILURE;
+            }
+
+            // with every dependency built, the repository can offer them all
+            if (link_installed() != PREP_SUCCESS) {
+                return PREP_FAILURE;
             }
 
             if (dynamic_cast<const PackageDependency*>(&config)) {
@@ -311,6 +579,66 @@ namespace micrantha {
             return PREP_SUCCESS;
         }
 
+        int Controller::get_dependencies(const Package &config, const Options &opts,
+                                         const std::vector<const PackageDependency *> &pending) {
+            Scheduler scheduler(opts.jobs);
+
+#ifdef HAVE_COROUTINES
+            auto task = resolve_dependencies(scheduler, pending);
+
+            if (scheduler.run() != PREP_SUCCESS || !task.done()) {
+                log::error("unable to resolve dependencies of ", config.name());
+                return PREP_FAILURE;
+            }
+
+            auto resolved = task.get();
+#else
+            std::vector<Plugin::Result> resolved(pending.size(), Plugin::Result(PREP_FAILURE));
+
+            // resolve the sources side by side
+            for (size_t i = 0; i < pending.size(); i++) {
+                repo_.notify_plugins_resolve(scheduler, *pending[i], [&resolved, i](const Plugin::Result &result) {
+                    resolved[i] = result;
+                });
+            }
+
+            if (scheduler.run() != PREP_SUCCESS) {
+                log::error("unable to resolve dependencies of ", config.name());
+                return PREP_FAILURE;
+            }
+#endif
+
+            // then build them in order, off the event loop so no resolve is left unread while a build runs
+            for (size_t i = 0; i < pending.size(); i++) {
+                if (build_dependency(*pending[i], opts, resolved[i]) == PREP_FAILURE) {
+                    return PREP_FAILURE;
+                }
+            }
+
+            return PREP_SUCCESS;
+        }
+
+#ifdef HAVE_COROUTINES
+        Task<std::vector<Plugin::Result>> Controller::resolve_dependencies(
+            Scheduler &scheduler, std::vector<const PackageDependency *> pending) {
+            std::vector<Task<Plugin::Result>> resolves;
+
+            // start resolving every source
+            for (auto dependency : pending) {
+                resolves.push_back(repo_.notify_plugins_resolve(scheduler, *dependency));
+            }
+
+            std::vector<Plugin::Result> resolved;
+
+            // every resolve is awaited, they can not be abandoned while running
+            for (auto &resolve : resolves) {
+                resolved.push_back(co_await resolve);
+            }
+
+            co_return resolved;
+        }
+#endif
+
         int Controller::get_package(const PackageDependency &config, const Options &opts, const std::string &path) {
 
             // try to add via plugin
@@ -323,7 +651,11 @@ namespace micrantha {
             }
 
             // then try to resolve the source
-            auto result = repo_.notify_plugins_resolve(config);
+            return build_dependency(config, opts, repo_.notify_plugins_resolve(config));
+        }
+
+        int Controller::build_dependency(const PackageDependency &config, const Options &opts,
+                                         const Plugin::Result &result) {
 
             if (result != PREP_SUCCESS || result.values.empty()) {
                 log::error("[", config.name(), "] could not resolve dependency [", config.name(), "]");
@@ -362,7 +694,7 @@ namespace micrantha {
 
             auto sourcePath = repo_.get_source_path(config.name());
 
-            return test_package(config, sourcePath);
+            return test_package(config, opts, sourcePath);
         }
 
         int Controller::install(const Package &config, const Options &opts) {
@@ -381,12 +713,26 @@ namespace micrantha {
 
             auto sourcePath = repo_.get_install_path(config.name());
 
-            if (install_package(config, sourcePath)) {
+            if (install_package(config, opts, sourcePath)) {
                 return PREP_FAILURE;
             }
 
             auto installPath = repo_.get_install_path(config.name());
 
+            set_runpaths(config, installPath);
+
+            repo_.mark_used(config.name());
+
+            // an isolated dependency is only needed by its dependents, which find it by prefix
+            if (opts.isolate && dynamic_cast<const PackageDependency *>(&config)) {
+                // remembered in case this run stops before it is linked
+                if (repo_.mark_unlinked(config.name()) != PREP_SUCCESS) {
+                    log::warn("unable to mark ", config.name(), " as unlinked");
+                }
+                unlinked_.push_back(installPath);
+                return PREP_SUCCESS;
+            }
+
             if (repo_.link_directory(installPath)) {
                 log::error("Unable to link package");
                 return PREP_FAILURE;
@@ -395,6 +741,169 @@ namespace micrantha {
             return PREP_SUCCESS;
         }
 
+        std::shared_ptr<const environment::Snapshot> Controller::get_environment(const Package &config,
+                                                                                 const Options &opts) const {
+            if (!opts.isolate) {
+                return environment::snapshot();
+            }
+
+            std::vector<std::string> prefixes;
+
+            get_prefixes(config, prefixes);
+
+            return std::make_shared<const environment::Snapshot>(prefixes);
+        }
+
+        void Controller::get_prefixes(const Package &config, std::vector<std::string> &prefixes) const {
+            for (const auto &dependency : config.dependencies()) {
+                auto prefix = repo_.get_install_path(dependency.name());
+
+                if (std::find(prefixes.begin(), prefixes.end(), prefix) != prefixes.end()) {
+                    continue;
+                }
+
+                prefixes.push_back(prefix);
+
+                get_prefixes(dependency, prefixes);
+            }
+        }
+
+        std::string Controller::get_runpath(const Package &config, const std::string &installPath) const {
+            std::vector<std::string> prefixes = {installPath};
+
+            get_prefixes(config, prefixes);
+
+            std::string runpath;
+
+            for (const auto &prefix : prefixes) {
+                if (!runpath.empty()) {
+                    runpath += ":";
+                }
+                runpath += filesystem::build_path(prefix, Repository::LIB_FOLDER);
+            }
+
+            return runpath;
+        }
+
+        void Controller::set_runpaths(const Package &config, const std::string &installPath) const {
+            auto runpath = get_runpath(config, installPath);
+
+            // the repository has every library, when the exact list does not fit
+            auto fallback = repo_.get_lib_path();
+            auto kitchen = repo_.get_kitchen_path();
+
+            // every executable and library found its libraries through its own search path
+            bool complete = true;
+
+            walk::Options options;
+
+            options.file = [&](const walk::Entry &entry) {
+                std::string current;
+
+                if (entry.type != DT_REG) {
+                    return walk::NEXT;
+                }
+
+                auto path = filesystem::build_path(installPath, entry.path());
+
+                // only files with a search path already have room for one
+                if (elf::get_runpath(path, current) != PREP_SUCCESS) {
+                    if (elf::is_dynamic(path)) {
+                        log::debug(path, " has no runpath to set");
+                        complete = false;
+                    }
+                    return walk::NEXT;
+                }
+
+                switch (elf::set_runpath(path, internal::merge_runpath(current, runpath, kitchen, fallback))) {
+                    case PREP_SUCCESS:
+                        log::debug("set runpath of ", path);
+                        break;
+                    case PREP_FAILURE:
+                        if (elf::set_runpath(path, internal::merge_runpath(current, fallback, kitchen, fallback)) ==
+                            PREP_SUCCESS) {
+                            log::debug("set runpath of ", path, " to the repository");
+                            break;
+                        }
+                        log::debug("no room for the runpath of ", path);
+                        complete = false;
+                        break;
+                    default:
+                        log::debug("unable to set runpath of ", path, " [", strerror(errno), "]");
+                        complete = false;
+                        break;
+                }
+
+                return walk::NEXT;
+            };
+
+            options.error = [&installPath](const walk::Entry &entry, int error) {
+                log::error("unable to read ", filesystem::build_path(installPath, entry.path()), " [",
+                           strerror(error), "]");
+            };
+
+            if (walk::tree(installPath, options) != PREP_SUCCESS) {
+                complete = false;
+            }
+
+            if (repo_.mark_runpaths(config.name(), complete) != PREP_SUCCESS) {
+                log::debug("unable to record the runpaths of ", config.name());
+            }
+        }
+
+        bool Controller::has_runpaths(const Package &config) const {
+            if (!repo_.has_runpaths(config.name())) {
+                return false;
+            }
+
+            for (const auto &dependency : config.dependencies()) {
+                if (!has_runpaths(dependency)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        int Controller::relocate(const Package &config) const {
+            switch (repo_.relocate(config)) {
+                case PREP_SUCCESS:
+                    break;
+                case PREP_FAILURE:
+                    return PREP_SUCCESS;
+                default:
+                    return PREP_FAILURE;
+            }
+
+            auto installPath = repo_.get_install_path(config.name());
+
+            // runpaths may have room for the exact paths again
+            set_runpaths(config, installPath);
+
+            // links in the repository still point at the old path
+            if (repo_.link_directory(installPath)) {
+                log::error("Unable to link package");
+                return PREP_FAILURE;
+            }
+
+            return PREP_SUCCESS;
+        }
+
+        int Controller::link_installed() {
+            int rval = PREP_SUCCESS;
+
+            for (const auto &installPath : unlinked_) {
+                if (repo_.link_directory(installPath)) {
+                    log::error("Unable to link ", installPath);
+                    rval = PREP_FAILURE;
+                }
+            }
+
+            unlinked_.clear();
+
+            return rval;
+        }
+
         int Controller::link(const Package &config) const {
             if (!config.is_loaded()) {
                 log::error("config is not loaded");
@@ -450,6 +959,15 @@ namespace micrantha {
 
             auto runEnv = environment::run_env();
 
+            // the executable and the libraries it loads find theirs once set_runpaths gave each of them a path
+            if (has_runpaths(config)) {
+                const std::string libraryPath = "LD_LIBRARY_PATH=";
+
+                runEnv.erase(std::remove_if(runEnv.begin(), runEnv.end(), [&libraryPath](const std::string &value) {
+                    return value.compare(0, libraryPath.length(), libraryPath) == 0;
+                }), runEnv.end());
+            }
+
             const char *envp[runEnv.size()+1];
 
             for (int i = 0; i < runEnv.size(); i++) {
@@ -471,5 +989,69 @@ namespace micrantha {
 
             return manager.execute(opts, argc, argv);
         }
+
+        int Controller::logs(const std::string &package_name, const char *hook, bool follow) const {
+            // in the order hooks run on a package
+            static const Plugin::Hooks hooks[] = {Plugin::Hooks::ADD, Plugin::Hooks::RESOLVE, Plugin::Hooks::BUILD,
+                                                  Plugin::Hooks::TEST, Plugin::Hooks::INSTALL, Plugin::Hooks::REMOVE};
+
+            auto logPath = repo_.get_log_path(package_name);
+
+            std::vector<std::string> paths;
+
+            for (auto value : hooks) {
+                auto name = Plugin::hook_name(value);
+
+                if (hook != nullptr && strcasecmp(hook, name.c_str())) {
+                    continue;
+                }
+
+                auto path = filesystem::build_path(logPath, name + Plugin::LOG_EXTENSION);
+
+                if (filesystem::file_exists(path) == PREP_SUCCESS) {
+                    paths.push_back(path);
+                } else if (hook != nullptr) {
+                    log::error("no ", name, " log for ", color::m(package_name));
+                    return PREP_FAILURE;
+                }
+            }
+
+            if (hook != nullptr && paths.empty()) {
+                log::error("unknown hook ", hook);
+                return PREP_FAILURE;
+            }
+
+            if (paths.empty()) {
+                log::error("no logs for ", color::m(package_name));
+                return PREP_FAILURE;
+            }
+
+            // follow the hook that ran last
+            if (follow) {
+                auto latest = std::max_element(paths.begin(), paths.end(), [](const std::string &a, const std::string &b) {
+                    struct stat sa = {}, sb = {};
+                    stat(a.c_str(), &sa);
+                    stat(b.c_str(), &sb);
+                    return sa.st_mtime < sb.st_mtime;
+                });
+
+                return log::read_file(*latest, std::cout, true);
+            }
+
+            for (const auto &path : paths) {
+                if (hook == nullptr) {
+                    auto name = path.substr(logPath.length() + 1);
+                    io::println("==> ", color::c(name.substr(0, name.length() - strlen(Plugin::LOG_EXTENSION))),
+                                " <==");
+                }
+
+                if (log::read_file(path, std::cout) != PREP_SUCCESS) {
+                    log::error("unable to read ", path);
+                    return PREP_FAILURE;
+                }
+            }
+
+            return PREP_SUCCESS;
+        }
     }
 }
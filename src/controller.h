@@ -1,12 +1,17 @@
 #ifndef MICRANTHA_PREP_PACKAGE_BUILDER_H
 #define MICRANTHA_PREP_PACKAGE_BUILDER_H
 
+#include <set>
+
 #include "environment.h"
 #include "package.h"
 #include "repository.h"
+#include "task.h"
 
 namespace micrantha {
     namespace prep {
+        class Scheduler;
+
         /**
          * the executor of package building and repository actions
          */
@@ -15,6 +20,9 @@ namespace micrantha {
             //! constructor
             Controller();
 
+            //! destructor, reports what the run saved
+            ~Controller();
+
             //! initializes this instance
             // @param opts the options to initialize with
             // @returns PREP_SUCCESS or PREP_FAILURE if an error occurred
@@ -69,6 +77,16 @@ namespace micrantha {
              */
             int cleanup(const Package &config, const Options &opts);
 
+            /**
+             * removes unused package folders from the kitchen to fit the repository budget.  builds go
+             * first, then sources, then installs nothing depends on, least recently used first in each.
+             * nothing the package at the options location needs is removed.
+             * @opts the command line options
+             * @param automatic only collect when the repository is short of free space
+             * @return PREP_SUCCESS, or PREP_FAILURE if anything could not be removed
+             */
+            int gc(const Options &opts, bool automatic = false);
+
             /**
              * links a package to bin path
              * TODO: a specific version
@@ -101,6 +119,15 @@ namespace micrantha {
              */
             int plugins(const Options &opts, int argc, char *const *argv);
 
+            /**
+             * prints the logged output of hooks run on a package
+             * @param package_name the package to print logs for
+             * @param hook the hook to print the log of, or nullptr for every hook
+             * @param follow true to keep printing the last hook's log until the hook is finished with it
+             * @return PREP_SUCCESS if a log was printed, otherwise PREP_FAILURE
+             */
+            int logs(const std::string &package_name, const char *hook, bool follow) const;
+
             /**
              * prints sourceable environment variables
              * @param var print a specific variable value
@@ -134,6 +161,34 @@ namespace micrantha {
              */
             int get_package(const PackageDependency &config, const Options &opts, const std::string &path);
 
+            /**
+             * internal method to build and install a dependency from its resolved source
+             * @param config the dependency config
+             * @param opts the command line options
+             * @param result the result of resolving the dependency source
+             * @return PREP_SUCCESS if installed, otherwise PREP_FAILURE
+             */
+            int build_dependency(const PackageDependency &config, const Options &opts, const Plugin::Result &result);
+
+            /**
+             * internal method to get several dependencies, resolving their sources side by side
+             * @param config the package the dependencies belong to
+             * @param opts the command line options
+             * @param pending the dependencies to get
+             * @return PREP_SUCCESS if all were installed, otherwise PREP_FAILURE
+             */
+            int get_dependencies(const Package &config, const Options &opts,
+                                 const std::vector<const PackageDependency *> &pending);
+
+#ifdef HAVE_COROUTINES
+            /**
+             * internal task to resolve the sources of dependencies side by side on a scheduler
+             * @return the result of each resolve, in the order of the dependencies
+             */
+            Task<std::vector<Plugin::Result>> resolve_dependencies(Scheduler &scheduler,
+                                                                   std::vector<const PackageDependency *> pending);
+#endif
+
             /**
              * internal method to build a package
              * @param p the package
@@ -148,7 +203,7 @@ namespace micrantha {
              * @param path the path to build in
              * @return PREP_SUCCESS if built, otherwise PREP_FAILURE
              */
-            int install_package(const Package &p, const std::string &path);
+            int install_package(const Package &p, const Options &opts, const std::string &path);
 
 
             /**
@@ -157,10 +212,69 @@ namespace micrantha {
              * @param path the path to build in
              * @return PREP_SUCCESS if built, otherwise PREP_FAILURE
              */
-            int test_package(const Package &p, const std::string &path);
+            int test_package(const Package &p, const Options &opts, const std::string &path);
+
+            /**
+             * gets the environment to run a package's hooks in
+             * @param config the package
+             * @param opts the command line options
+             * @return the repository environment, or with --isolate one for the package's dependencies alone
+             */
+            std::shared_ptr<const environment::Snapshot> get_environment(const Package &config,
+                                                                          const Options &opts) const;
+
+            /**
+             * adds the install prefixes of a package's dependencies and theirs, once each
+             */
+            void get_prefixes(const Package &config, std::vector<std::string> &prefixes) const;
+
+            /**
+             * the library search path set_runpaths gives a package: its own lib folder, then those of
+             * its dependencies
+             */
+            std::string get_runpath(const Package &config, const std::string &installPath) const;
+
+            /**
+             * points the library search path of installed executables and libraries at the package and
+             * its dependencies, so they run without LD_LIBRARY_PATH
+             * @param config the installed package
+             * @param installPath where the package was installed
+             */
+            void set_runpaths(const Package &config, const std::string &installPath) const;
+
+            /**
+             * tests if set_runpaths gave every executable and library of a package and its dependencies
+             * a search path, so nothing needs LD_LIBRARY_PATH
+             */
+            bool has_runpaths(const Package &config) const;
+
+            /**
+             * moves a cached package to this repository path if it was built elsewhere
+             * @return PREP_SUCCESS, or PREP_FAILURE if it could not be relocated
+             */
+            int relocate(const Package &config) const;
+
+            /**
+             * adds the names of a package and everything it depends on, once each
+             */
+            void get_graph(const Package &config, std::set<std::string> &names) const;
+
+            /**
+             * removes a package folder from the kitchen, unlinking an install first
+             * @return PREP_SUCCESS, or PREP_FAILURE if it could not be removed
+             */
+            int evict(const Repository::Folder &folder) const;
+
+            /**
+             * links dependencies whose install was not linked to the repository yet
+             * @return PREP_SUCCESS if all were linked, otherwise PREP_FAILURE
+             */
+            int link_installed();
 
             // fields
             Repository repo_;
+            // install paths of isolated dependencies, linked once all are built
+            std::vector<std::string> unlinked_;
         };
     }
 }
@@ -0,0 +1,279 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "common.h"
+#include "elf_file.h"
+
+namespace micrantha {
+  namespace prep {
+    namespace elf {
+
+      namespace internal {
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        constexpr static const unsigned char NATIVE_DATA = ELFDATA2LSB;
+#else
+        constexpr static const unsigned char NATIVE_DATA = ELFDATA2MSB;
+#endif
+
+        // where the search path of a file is, once mapped
+        typedef struct {
+          char *value;
+          size_t length;
+          // the room the string has, not counting the terminator
+          size_t room;
+        } Location;
+
+        /**
+         * @return the file offset of a virtual address, or 0 if it is not loaded from the file
+         */
+        template <typename Phdr>
+        size_t to_offset(const Phdr *headers, size_t count, size_t address) {
+          for (size_t i = 0; i < count; i++) {
+            if (headers[i].p_type == PT_LOAD && address >= headers[i].p_vaddr &&
+                address < headers[i].p_vaddr + headers[i].p_filesz) {
+              return address - headers[i].p_vaddr + headers[i].p_offset;
+            }
+          }
+          return 0;
+        }
+
+        /**
+         * finds the search path in a mapped file of one ELF class
+         * @return PREP_SUCCESS if found, otherwise PREP_FAILURE
+         */
+        template <typename Ehdr, typename Phdr, typename Dyn>
+        int find_runpath(char *data, size_t size, Location &location) {
+          auto header = reinterpret_cast<const Ehdr *>(data);
+
+          if (size < sizeof(Ehdr) || header->e_phentsize != sizeof(Phdr) || header->e_phoff > size ||
+              header->e_phnum > (size - header->e_phoff) / sizeof(Phdr)) {
+            return PREP_FAILURE;
+          }
+
+          auto headers = reinterpret_cast<const Phdr *>(data + header->e_phoff);
+
+          for (size_t i = 0; i < header->e_phnum; i++) {
+            if (headers[i].p_type != PT_DYNAMIC) {
+              continue;
+            }
+
+            if (headers[i].p_offset > size || headers[i].p_filesz > size - headers[i].p_offset) {
+              return PREP_FAILURE;
+            }
+
+            auto entries = reinterpret_cast<Dyn *>(data + headers[i].p_offset);
+            size_t count = headers[i].p_filesz / sizeof(Dyn);
+            size_t table = 0, tableSize = 0;
+            Dyn *found = nullptr;
+
+            for (size_t j = 0; j < count && entries[j].d_tag != DT_NULL; j++) {
+              switch (entries[j].d_tag) {
+                case DT_STRTAB:
+                  table = entries[j].d_un.d_ptr;
+                  break;
+                case DT_STRSZ:
+                  tableSize = entries[j].d_un.d_val;
+                  break;
+                case DT_RUNPATH:
+                  found = &entries[j];
+                  break;
+                case DT_RPATH:
+                  // a runpath wins when a file has both
+                  if (found == nullptr) {
+                    found = &entries[j];
+                  }
+                  break;
+              }
+            }
+
+            if (found == nullptr || table == 0) {
+              return PREP_FAILURE;
+            }
+
+            size_t offset = to_offset(headers, header->e_phnum, table);
+
+            if (offset == 0 || offset > size || tableSize > size - offset || found->d_un.d_val >= tableSize) {
+              return PREP_FAILURE;
+            }
+
+            location.value = data + offset + found->d_un.d_val;
+            location.length = strnlen(location.value, tableSize - found->d_un.d_val);
+
+            location.room = location.length;
+
+            // a shorter path written before leaves the rest of its room cleared
+            for (size_t end = found->d_un.d_val + location.length; end + 1 < tableSize && data[offset + end + 1] == '\0';
+                 end++) {
+              location.room++;
+            }
+
+            return PREP_SUCCESS;
+          }
+
+          return PREP_FAILURE;
+        }
+
+        /**
+         * tests for a dynamic section in the program headers of one ELF class
+         */
+        template <typename Ehdr, typename Phdr>
+        bool has_dynamic(int fd) {
+          Ehdr header = {};
+
+          if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.e_phentsize != sizeof(Phdr)) {
+            return false;
+          }
+
+          for (size_t i = 0; i < header.e_phnum; i++) {
+            Phdr program = {};
+
+            if (pread(fd, &program, sizeof(program), static_cast<off_t>(header.e_phoff + i * sizeof(Phdr))) !=
+                sizeof(program)) {
+              return false;
+            }
+
+            if (program.p_type == PT_DYNAMIC) {
+              return true;
+            }
+          }
+
+          return false;
+        }
+
+        /**
+         * maps a file and finds its search path
+         * @param writable true to map the file for changing
+         * @param callback given the location while the file is mapped
+         */
+        template <typename Callback>
+        int with_runpath(const std::string &path, bool writable, const Callback &callback) {
+          int fd = open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+
+          if (fd == -1) {
+            return PREP_ERROR;
+          }
+
+          struct stat st = {};
+
+          if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            return PREP_ERROR;
+          }
+
+          if (st.st_size < EI_NIDENT) {
+            close(fd);
+            return PREP_FAILURE;
+          }
+
+          auto size = static_cast<size_t>(st.st_size);
+
+          void *map = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+          close(fd);
+
+          if (map == MAP_FAILED) {
+            return PREP_ERROR;
+          }
+
+          auto data = static_cast<char *>(map);
+          auto ident = reinterpret_cast<const unsigned char *>(data);
+          Location location = {};
+          int rval = PREP_FAILURE;
+
+          // only files for this machine's byte order are read
+          if (memcmp(ident, ELFMAG, SELFMAG) == 0 && ident[EI_DATA] == NATIVE_DATA) {
+            if (ident[EI_CLASS] == ELFCLASS64) {
+              rval = find_runpath<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(data, size, location);
+            } else if (ident[EI_CLASS] == ELFCLASS32) {
+              rval = find_runpath<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(data, size, location);
+            }
+          }
+
+          if (rval == PREP_SUCCESS) {
+            rval = callback(location);
+          }
+
+          if (writable && msync(map, size, MS_SYNC) == -1) {
+            rval = PREP_ERROR;
+          }
+
+          munmap(map, size);
+
+          return rval;
+        }
+      }  // namespace internal
+
+      int get_runpath(const std::string &path, std::string &runpath) {
+        return internal::with_runpath(path, false, [&runpath](const internal::Location &location) {
+          runpath.assign(location.value, location.length);
+          return PREP_SUCCESS;
+        });
+      }
+
+      bool is_dynamic(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd == -1) {
+          return false;
+        }
+
+        unsigned char ident[EI_NIDENT] = {};
+        bool dynamic = false;
+
+        if (pread(fd, ident, sizeof(ident), 0) == sizeof(ident) && memcmp(ident, ELFMAG, SELFMAG) == 0 &&
+            ident[EI_DATA] == internal::NATIVE_DATA) {
+          if (ident[EI_CLASS] == ELFCLASS64) {
+            dynamic = internal::has_dynamic<Elf64_Ehdr, Elf64_Phdr>(fd);
+          } else if (ident[EI_CLASS] == ELFCLASS32) {
+            dynamic = internal::has_dynamic<Elf32_Ehdr, Elf32_Phdr>(fd);
+          }
+        }
+
+        close(fd);
+
+        return dynamic;
+      }
+
+      int set_runpath(const std::string &path, const std::string &runpath) {
+        struct stat st = {};
+
+        if (stat(path.c_str(), &st) == -1) {
+          return PREP_ERROR;
+        }
+
+        // installed files are often read only
+        bool restore = (st.st_mode & S_IWUSR) == 0;
+
+        if (restore && chmod(path.c_str(), st.st_mode | S_IWUSR) == -1) {
+          return PREP_ERROR;
+        }
+
+        int rval = internal::with_runpath(path, true, [&runpath](const internal::Location &location) {
+          if (runpath.length() > location.room) {
+            return PREP_FAILURE;
+          }
+
+          // the rest of the room is cleared so nothing is left of the old path
+          memcpy(location.value, runpath.c_str(), runpath.length());
+          memset(location.value + runpath.length(), 0, location.room - runpath.length());
+
+          return PREP_SUCCESS;
+        });
+
+        if (restore) {
+          int error = errno;
+          chmod(path.c_str(), st.st_mode);
+          errno = error;
+        }
+
+        return rval;
+      }
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef MICRANTHA_PREP_ELF_FILE_H
+#define MICRANTHA_PREP_ELF_FILE_H
+
+#include <string>
+
+namespace micrantha {
+  namespace prep {
+    namespace elf {
+
+      /**
+       * reads the library search path of an executable or shared library
+       * @param path the file to read
+       * @param runpath set to the DT_RUNPATH, or DT_RPATH, of the file
+       * @return PREP_SUCCESS if the file has a search path, PREP_FAILURE if it has none or is not a
+       * dynamic ELF object, PREP_ERROR if the file could not be read
+       */
+      int get_runpath(const std::string &path, std::string &runpath);
+
+      /**
+       * tests if a file is an executable or shared library that is linked at run time
+       */
+      bool is_dynamic(const std::string &path);
+
+      /**
+       * replaces the library search path of an executable or shared library in place.  the file keeps
+       * its size, so the new path must fit where the existing DT_RUNPATH or DT_RPATH string is.  the
+       * entry keeps its kind, as a DT_RPATH is also searched for the libraries of libraries.
+       * @param path the file to change
+       * @param runpath a colon separated list of directories
+       * @return PREP_SUCCESS if changed, PREP_FAILURE if the file is not a dynamic ELF object, has no search
+       * path or the new one does not fit, PREP_ERROR if the file could not be changed
+       */
+      int set_runpath(const std::string &path, const std::string &runpath);
+    }
+  }
+}
+
+#endif
@@ -11,19 +11,34 @@ namespace micrantha {
     namespace build {
       namespace fs = filesystem;
 
-      std::string flags(const std::string &varName, const std::string &flag, const std::string &folder) {
-        std::ostringstream buf;
-        auto temp = Repository::get_local_repo();
+      /**
+       * @return the repositories that exist, global first
+       */
+      std::vector<std::string> repositories() {
+        std::vector<std::string> repos;
 
         if (fs::directory_exists(Repository::GLOBAL_REPO) == PREP_SUCCESS) {
-          buf << " " << flag << fs::build_path(Repository::GLOBAL_REPO, folder);
+          repos.emplace_back(Repository::GLOBAL_REPO);
+        }
+
+        auto local = Repository::get_local_repo();
+
+        if (fs::directory_exists(local) == PREP_SUCCESS) {
+          repos.push_back(local);
         }
 
-        if (fs::directory_exists(temp) == PREP_SUCCESS) {
-          buf << " " << flag << fs::build_path(temp, folder);
+        return repos;
+      }
+
+      std::string flags(const std::vector<std::string> &repos, const std::string &varName, const std::string &flag,
+                        const std::string &folder) {
+        std::ostringstream buf;
+
+        for (const auto &repo : repos) {
+          buf << " " << flag << fs::build_path(repo, folder);
         }
 
-        temp = environment::get(varName);
+        auto temp = environment::get(varName);
 
         if (!temp.empty()) {
           buf << " " << temp;
@@ -32,20 +47,14 @@ namespace micrantha {
         return buf.str();
       }
 
-      std::string path(const std::string &varName, const std::string &folder) {
+      std::string path(const std::vector<std::string> &repos, const std::string &varName, const std::string &folder) {
         std::vector<std::string> paths;
 
-        auto temp = Repository::get_local_repo();
-
-        if (fs::directory_exists(Repository::GLOBAL_REPO) == PREP_SUCCESS) {
-          paths.push_back(fs::build_path(Repository::GLOBAL_REPO, folder));
-        }
-
-        if (fs::directory_exists(temp) == PREP_SUCCESS) {
-          paths.push_back(fs::build_path(temp, folder));
+        for (const auto &repo : repos) {
+          paths.push_back(fs::build_path(repo, folder));
         }
 
-        temp = environment::get(varName);
+        auto temp = environment::get(varName);
 
         if (!temp.empty()) {
           paths.push_back(temp);
@@ -62,6 +71,9 @@ namespace micrantha {
         }
         return buf.str();
       }
+
+      // the snapshot hooks share, if one has been worked out
+      std::shared_ptr<const environment::Snapshot> current;
     }  // namespace build
 
     std::string environment::get(const std::string &key) {
@@ -80,40 +92,48 @@ namespace micrantha {
       }
 
       setenv(key.c_str(), value.c_str(), overwrite);
+
+      // snapshots include variables from the environment
+      invalidate();
     }
 
-    std::vector<std::string> environment::run_env() {
-      std::vector<std::string> env;
+    environment::Snapshot::Snapshot() : Snapshot(build::repositories()) {}
 
-      for (const auto &entry : run_map()) {
-        env.push_back(entry.first + "=" + entry.second);
-      }
-      return env;
-    }
+    environment::Snapshot::Snapshot(const std::vector<std::string> &repos) {
+      runMap_ = {{"LD_LIBRARY_PATH", build::path(repos, "LD_LIBRARY_PATH", "lib")},
+                 {"PATH", build::path(repos, "PATH", "bin")},
+                 {"TERM", environment::get("TERM")}};
+
+      buildMap_ = runMap_;
 
-    std::vector<std::string> environment::build_env() {
-      std::vector<std::string> env;
+      buildMap_["CXXFLAGS"] = build::flags(repos, "CXXFLAGS", "-I", "include");
+      buildMap_["LDFLAGS"] = build::flags(repos, "LDFLAGS", "-L", "lib");
+      buildMap_["PKG_CONFIG_PATH"] = build::path(repos, "PKG_CONFIG_PATH", "lib/pkgconfig");
 
-      for (const auto &entry : build_map()) {
-        env.push_back(entry.first + "=\"" + entry.second + "\"");
+      for (const auto &entry : runMap_) {
+        runEnv_.push_back(entry.first + "=" + entry.second);
+      }
+
+      for (const auto &entry : buildMap_) {
+        buildEnv_.push_back(entry.first + "=\"" + entry.second + "\"");
       }
-      return env;
     }
 
-    std::map<std::string, std::string> environment::run_map() {
-      return {{"LD_LIBRARY_PATH", build::path("LD_LIBRARY_PATH", "lib")},
-              {"PATH", build::path("PATH", "bin")},
-              {"TERM", environment::get("TERM")}};
+    std::shared_ptr<const environment::Snapshot> environment::snapshot() {
+      if (!build::current) {
+        build::current = std::make_shared<const Snapshot>();
+      }
+      return build::current;
     }
 
-    std::map<std::string, std::string> environment::build_map() {
-      auto map = run_map();
+    void environment::invalidate() { build::current.reset(); }
 
-      map["CXXFLAGS"] = build::flags("CXXFLAGS", "-I", "include");
-      map["LDFLAGS"] = build::flags("LDFLAGS", "-L", "lib");
-      map["PKG_CONFIG_PATH"] = build::path("PKG_CONFIG_PATH", "lib/pkgconfig");
+    std::vector<std::string> environment::run_env() { return snapshot()->run_env(); }
 
-      return map;
-    }
+    std::vector<std::string> environment::build_env() { return snapshot()->build_env(); }
+
+    std::map<std::string, std::string> environment::run_map() { return snapshot()->run_map(); }
+
+    std::map<std::string, std::string> environment::build_map() { return snapshot()->build_map(); }
   }  // namespace prep
 }  // namespace micrantha
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 namespace micrantha
 {
@@ -55,6 +56,53 @@ namespace micrantha
              */
             std::string build_ldpath(const std::string &varName);
 
+            /**
+             * the variables prep gives plugins, worked out once from the repositories and
+             * the environment.  a snapshot does not change, hooks share the current one
+             * until it is invalidated.
+             */
+            class Snapshot
+            {
+            public:
+                // the variables for the repositories
+                Snapshot();
+
+                /**
+                 * the variables for a set of install prefixes alone
+                 * @param prefixes folders holding bin, include, lib etc
+                 */
+                explicit Snapshot(const std::vector<std::string> &prefixes);
+
+                // build variable keys and values (build, link, and paths)
+                const std::map<std::string,std::string> &build_map() const { return buildMap_; }
+
+                // runtime variable keys and values
+                const std::map<std::string,std::string> &run_map() const { return runMap_; }
+
+                // build variables as quoted key=value strings
+                const std::vector<std::string> &build_env() const { return buildEnv_; }
+
+                // runtime variables as key=value strings
+                const std::vector<std::string> &run_env() const { return runEnv_; }
+
+            private:
+                std::map<std::string,std::string> buildMap_;
+                std::map<std::string,std::string> runMap_;
+                std::vector<std::string> buildEnv_;
+                std::vector<std::string> runEnv_;
+            };
+
+            /**
+             * gets the current snapshot, working it out if there is none
+             * @return the snapshot, valid for as long as it is held
+             */
+            std::shared_ptr<const Snapshot> snapshot();
+
+            /**
+             * discards the current snapshot, for when a repository or the environment changes
+             */
+            void invalidate();
+
             /**
              * creates a map of build variable keys and values (build, link, and paths)
              * NOTE: paths are based on the current repository if exists
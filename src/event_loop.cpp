@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+#include "common.h"
+#include "event_loop.h"
+#include "log.h"
+
+namespace micrantha {
+  namespace prep {
+
+    namespace internal {
+      // how often children without a pidfd are checked
+      constexpr const long REAP_INTERVAL = 100;
+
+      constexpr const int MAX_EVENTS = 64;
+
+      // descriptor numbers are reused, so an event also carries the serial of its watch
+      uint64_t to_event(int fd, uint32_t serial) {
+        return (static_cast<uint64_t>(serial) << 32) | static_cast<uint32_t>(fd);
+      }
+
+      int to_fd(uint64_t event) { return static_cast<int>(event & 0xFFFFFFFF); }
+
+      uint32_t to_serial(uint64_t event) { return static_cast<uint32_t>(event >> 32); }
+
+      // opens a descriptor that is readable when a process exits
+      int open_pidfd(pid_t pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+      }
+
+      // a watch may be removed or replaced by an earlier callback in the same batch
+      uint32_t next_serial() {
+        static uint32_t serial = 0;
+        return ++serial;
+      }
+    }
+
+    EventLoop::EventLoop() : fd_(-1) {
+#ifdef __linux__
+      fd_ = epoll_create1(EPOLL_CLOEXEC);
+
+      if (fd_ == -1) {
+        log::debug("epoll unavailable (", strerror(errno), "), polling");
+      }
+#endif
+    }
+
+    EventLoop::~EventLoop() {
+      for (const auto &entry : pidfds_) {
+        ::close(entry.first);
+      }
+
+      if (fd_ != -1) {
+        ::close(fd_);
+      }
+    }
+
+    int EventLoop::watch(int fd, const io_callback &callback) {
+      auto serial = internal::next_serial();
+
+#ifdef __linux__
+      if (fd_ != -1) {
+        struct epoll_event event = {};
+
+        event.events = EPOLLIN;
+        event.data.u64 = internal::to_event(fd, serial);
+
+        int op = watches_.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        if (epoll_ctl(fd_, op, fd, &event) == -1) {
+          log::perror("epoll_ctl");
+          return PREP_ERROR;
+        }
+      }
+#endif
+
+      watches_[fd] = {callback, serial};
+
+      return PREP_SUCCESS;
+    }
+
+    void EventLoop::unwatch(int fd) {
+      if (watches_.erase(fd) == 0) {
+        return;
+      }
+
+#ifdef __linux__
+      if (fd_ != -1 && epoll_ctl(fd_, EPOLL_CTL_DEL, fd, nullptr) == -1 && errno != EBADF) {
+        log::perror("epoll_ctl");
+      }
+#endif
+    }
+
+    int EventLoop::watch_child(pid_t pid, const exit_callback &callback) {
+      int pidfd = internal::open_pidfd(pid);
+
+      if (pidfd == -1) {
+        // no pidfd on this system, check on the child every so often
+        children_[pid] = callback;
+        return PREP_SUCCESS;
+      }
+
+      pidfds_[pidfd] = pid;
+
+      auto rval = watch(pidfd, [this, pid, callback](int fd) {
+        int status = 0;
+
+        unwatch(fd);
+        pidfds_.erase(fd);
+        ::close(fd);
+
+        if (waitpid(pid, &status, 0) == -1) {
+          log::perror("waitpid");
+          // report as a plugin error
+          status = 255 << 8;
+        }
+
+        callback(pid, status);
+      });
+
+      if (rval == PREP_ERROR) {
+        pidfds_.erase(pidfd);
+        ::close(pidfd);
+        children_[pid] = callback;
+      }
+
+      return PREP_SUCCESS;
+    }
+
+    bool EventLoop::empty() const { return watches_.empty() && children_.empty(); }
+
+    int EventLoop::reap() {
+      int count = 0;
+
+      for (auto it = children_.begin(); it != children_.end();) {
+        int status = 0;
+
+        auto pid = waitpid(it->first, &status, WNOHANG);
+
+        if (pid == 0) {
+          ++it;
+          continue;
+        }
+
+        if (pid == -1) {
+          log::perror("waitpid");
+          status = 255 << 8;
+        }
+
+        auto callback = it->second;
+
+        pid = it->first;
+
+        it = children_.erase(it);
+
+        callback(pid, status);
+
+        count++;
+      }
+
+      return count;
+    }
+
+    int EventLoop::run_once(long timeout) {
+      // wake up to check on children without a pidfd
+      if (!children_.empty() && (timeout < 0 || timeout > internal::REAP_INTERVAL)) {
+        timeout = internal::REAP_INTERVAL;
+      }
+
+      std::vector<uint64_t> ready;
+
+#ifdef __linux__
+      if (fd_ != -1) {
+        struct epoll_event events[internal::MAX_EVENTS];
+
+        int n = epoll_wait(fd_, events, internal::MAX_EVENTS, static_cast<int>(timeout));
+
+        if (n == -1) {
+          if (errno == EINTR) {
+            return 0;
+          }
+          log::perror("epoll_wait");
+          return PREP_ERROR;
+        }
+
+        for (int i = 0; i < n; i++) {
+          ready.push_back(events[i].data.u64);
+        }
+      }
+#endif
+
+      if (fd_ == -1) {
+        std::vector<struct pollfd> fds;
+        std::vector<uint32_t> serials;
+
+        for (const auto &entry : watches_) {
+          fds.push_back({entry.first, POLLIN, 0});
+          serials.push_back(entry.second.serial);
+        }
+
+        int n = poll(fds.data(), fds.size(), static_cast<int>(timeout));
+
+        if (n == -1) {
+          if (errno == EINTR) {
+            return 0;
+          }
+          log::perror("poll");
+          return PREP_ERROR;
+        }
+
+        for (size_t i = 0; i < fds.size() && n > 0; i++) {
+          if (fds[i].revents) {
+            ready.push_back(internal::to_event(fds[i].fd, serials[i]));
+            n--;
+          }
+        }
+      }
+
+      int count = 0;
+
+      for (auto event : ready) {
+        auto it = watches_.find(internal::to_fd(event));
+
+        // removed or replaced by an earlier callback
+        if (it == watches_.end() || it->second.serial != internal::to_serial(event)) {
+          continue;
+        }
+
+        // the callback may unwatch itself
+        auto callback = it->second.callback;
+
+        callback(internal::to_fd(event));
+
+        count++;
+      }
+
+      return count + reap();
+    }
+  }
+}
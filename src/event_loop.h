@@ -0,0 +1,83 @@
+#ifndef MICRANTHA_PREP_EVENT_LOOP_H
+#define MICRANTHA_PREP_EVENT_LOOP_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <sys/types.h>
+
+namespace micrantha {
+  namespace prep {
+
+    /**
+     * waits on many file descriptors and child processes from a single thread.
+     * uses epoll and pidfd on linux, poll and waitpid elsewhere.
+     */
+    class EventLoop {
+     public:
+      // called when a descriptor is readable or hung up
+      typedef std::function<void(int fd)> io_callback;
+
+      // called with the wait status of an exited child
+      typedef std::function<void(pid_t pid, int status)> exit_callback;
+
+      EventLoop();
+
+      ~EventLoop();
+
+      /* non-copyable */
+      EventLoop(const EventLoop &other) = delete;
+
+      EventLoop &operator=(const EventLoop &other) = delete;
+
+      /**
+       * watches a descriptor for input
+       * @return PREP_SUCCESS or PREP_ERROR if the descriptor could not be watched
+       */
+      int watch(int fd, const io_callback &callback);
+
+      /**
+       * stops watching a descriptor, the descriptor is not closed
+       */
+      void unwatch(int fd);
+
+      /**
+       * watches for a child process to exit, the child is reaped by the loop
+       * @return PREP_SUCCESS
+       */
+      int watch_child(pid_t pid, const exit_callback &callback);
+
+      /**
+       * waits for events and runs their callbacks
+       * @param timeout the milliseconds to wait, or -1 to wait until something happens
+       * @return the number of events handled, or PREP_ERROR on error
+       */
+      int run_once(long timeout = -1);
+
+      /**
+       * @return true if nothing is being watched
+       */
+      bool empty() const;
+
+     private:
+      // reaps children that are not watched with a descriptor
+      int reap();
+
+      typedef struct Watch {
+        io_callback callback;
+        // tells apart watches of a reused descriptor
+        uint32_t serial;
+      } Watch;
+
+      // the epoll instance, or -1 if polling
+      int fd_;
+      std::map<int, Watch> watches_;
+      // children without a pidfd, reaped by polling
+      std::map<pid_t, exit_callback> children_;
+      // pidfds and the children they watch
+      std::map<int, pid_t> pidfds_;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,196 @@
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cerrno>
+#include <deque>
+#include <functional>
+#include <thread>
+
+#include "common.h"
+#include "log_file.h"
+#include "util.h"
+
+namespace micrantha {
+  namespace prep {
+    namespace log {
+
+      namespace internal {
+        // how often a followed log is checked for more
+        constexpr static const std::chrono::milliseconds POLL_INTERVAL = std::chrono::milliseconds(250);
+
+        /**
+         * tests if a log is still open for writing, by a hook in this or another process
+         */
+        bool is_writing(const std::string &path) {
+          int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+          if (fd == -1) {
+            return false;
+          }
+
+          // a writer holds a shared lock until the log is finished
+          bool writing = flock(fd, LOCK_EX | LOCK_NB) == -1 && errno == EWOULDBLOCK;
+
+          close(fd);
+
+          return writing;
+        }
+
+        /**
+         * reads a log in blocks
+         * @param follow true to wait for more once the end is reached, while the log is being written
+         * @return PREP_SUCCESS, or PREP_FAILURE if the log could not be read
+         */
+        int read_blocks(const std::string &path, bool follow, const std::function<void(const char *, size_t)> &block) {
+          gzFile file = gzopen(path.c_str(), "rb");
+
+          if (file == nullptr) {
+            return PREP_FAILURE;
+          }
+
+          char buf[BUFSIZ];
+
+          for (;;) {
+            int n = gzread(file, buf, sizeof(buf));
+
+            if (n > 0) {
+              block(buf, static_cast<size_t>(n));
+              continue;
+            }
+
+            int error = Z_OK;
+
+            gzerror(file, &error);
+
+            // the end of what has been written so far, the rest may still be coming
+            if (n < 0 && error != Z_BUF_ERROR) {
+              gzclose(file);
+              return PREP_FAILURE;
+            }
+
+            if (!follow) {
+              break;
+            }
+
+            // read once more for what was written before the writer finished
+            if (!is_writing(path)) {
+              follow = false;
+            } else {
+              std::this_thread::sleep_for(POLL_INTERVAL);
+            }
+
+            gzclearerr(file);
+          }
+
+          gzclose(file);
+
+          return PREP_SUCCESS;
+        }
+      }
+
+      File::File(const std::string &path, bool append) : file_(nullptr), flushed_(std::chrono::steady_clock::now()) {
+        auto slash = path.rfind('/');
+
+        if (slash != std::string::npos && filesystem::create_path(path.substr(0, slash)) != PREP_SUCCESS) {
+          return;
+        }
+
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+
+        if (fd == -1) {
+          return;
+        }
+
+        // lets a reader following the log know when it is finished, see read_file
+        flock(fd, LOCK_SH);
+
+        // favour speed, logs are written as fast as plugins produce output
+        file_ = gzdopen(fd, append ? "ab1" : "wb1");
+
+        if (file_ == nullptr) {
+          close(fd);
+        }
+      }
+
+      File::~File() {
+        if (file_ != nullptr) {
+          gzclose(file_);
+        }
+      }
+
+      bool File::is_open() const { return file_ != nullptr; }
+
+      int File::write_line(std::string_view line) {
+        if (file_ == nullptr) {
+          return PREP_ERROR;
+        }
+
+        if ((!line.empty() && gzwrite(file_, line.data(), line.length()) == 0) || gzputc(file_, '\n') < 0) {
+          return PREP_ERROR;
+        }
+
+        if (std::chrono::steady_clock::now() - flushed_ >= FLUSH_INTERVAL) {
+          return flush();
+        }
+
+        return PREP_SUCCESS;
+      }
+
+      int File::flush() {
+        if (file_ == nullptr) {
+          return PREP_ERROR;
+        }
+
+        flushed_ = std::chrono::steady_clock::now();
+
+        return gzflush(file_, Z_SYNC_FLUSH) == Z_OK ? PREP_SUCCESS : PREP_ERROR;
+      }
+
+      int read_file(const std::string &path, std::ostream &out, bool follow) {
+        return internal::read_blocks(path, follow, [&out, follow](const char *buf, size_t length) {
+          out.write(buf, length);
+
+          if (follow) {
+            out.flush();
+          }
+        });
+      }
+
+      std::vector<std::string> tail_file(const std::string &path, size_t count) {
+        std::deque<std::string> lines;
+        std::string partial;
+
+        if (count == 0) {
+          return {};
+        }
+
+        internal::read_blocks(path, false, [&lines, &partial, count](const char *buf, size_t length) {
+          for (size_t i = 0; i < length; i++) {
+            if (buf[i] != '\n') {
+              partial += buf[i];
+              continue;
+            }
+
+            lines.push_back(std::move(partial));
+            partial.clear();
+
+            if (lines.size() > count) {
+              lines.pop_front();
+            }
+          }
+        });
+
+        if (!partial.empty()) {
+          lines.push_back(std::move(partial));
+
+          if (lines.size() > count) {
+            lines.pop_front();
+          }
+        }
+
+        return std::vector<std::string>(lines.begin(), lines.end());
+      }
+    }
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef MICRANTHA_PREP_LOG_FILE_H
+#define MICRANTHA_PREP_LOG_FILE_H
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct gzFile_s;
+
+namespace micrantha {
+  namespace prep {
+    namespace log {
+
+      /**
+       * a gzip compressed log, written a line at a time as output arrives.  the compressed stream
+       * is flushed now and then, so a log can be read while it is still being written.
+       */
+      class File {
+       public:
+        // how often written lines are made readable
+        constexpr static const std::chrono::milliseconds FLUSH_INTERVAL = std::chrono::seconds(1);
+
+        /**
+         * opens a log, creating its directory if needed
+         * @param path the path of the log
+         * @param append true to add to an existing log instead of replacing it
+         */
+        File(const std::string &path, bool append);
+
+        /* finishes the log */
+        ~File();
+
+        /* non-copyable */
+        File(const File &other) = delete;
+
+        File &operator=(const File &other) = delete;
+
+        bool is_open() const;
+
+        /**
+         * adds a line to the log
+         * @return PREP_SUCCESS or PREP_ERROR on error
+         */
+        int write_line(std::string_view line);
+
+        /**
+         * makes everything written so far readable
+         * @return PREP_SUCCESS or PREP_ERROR on error
+         */
+        int flush();
+
+       private:
+        struct gzFile_s *file_;
+        std::chrono::steady_clock::time_point flushed_;
+      };
+
+      /**
+       * writes a log to a stream
+       * @param path the path of the log
+       * @param out the stream to write to
+       * @param follow true to keep writing what is added to the log until its writer closes it
+       * @return PREP_SUCCESS, or PREP_FAILURE if the log could not be read
+       */
+      int read_file(const std::string &path, std::ostream &out, bool follow = false);
+
+      /**
+       * @param path the path of the log
+       * @param count the number of lines wanted
+       * @return up to the last count lines of a log
+       */
+      std::vector<std::string> tail_file(const std::string &path, size_t count);
+    }
+  }
+}
+
+#endif
@@ -26,7 +26,9 @@ void print_help(const Options &options) {
         io::println(std::setw(12), options.exe, " link <package> [version]");
         io::println(std::setw(12), options.exe, " unlink <package>");
         io::println(std::setw(12), options.exe, " cleanup [package]");
+        io::println(std::setw(12), options.exe, " gc");
         io::println(std::setw(12), options.exe, " plugins [options...]");
+        io::println(std::setw(12), options.exe, " logs [package] [--hook <hook>] [-f]");
         io::println(std::setw(12), options.exe, " run");
         io::println(std::setw(12), options.exe, " env");
         io::println(std::setw(12), options.exe, " check");
@@ -45,20 +47,28 @@ int main(int argc, char *const argv[]) {
             .force_build = ForceLevel::None,
             .verbose = Verbosity::None,
             .defaults = false,
+            .jobs = 0,
+            .isolate = false,
             .exe = argv[0]};
     const char *command = nullptr;
+    const char *hook = nullptr;
+    bool follow = false;
     int option;
     int option_index = 0;
     static struct option opts[] = {{"global",   no_argument,       nullptr, 'g'},
                                    {"config",  required_argument, nullptr, 'c'},
                                    {"force",    no_argument,       nullptr, 'f'},
+                                   {"follow",   no_argument,       nullptr, 4},
+                                   {"hook",     required_argument, nullptr, 2},
+                                   {"isolate",  no_argument,       nullptr, 3},
                                    {"verbose",  optional_argument, nullptr, 'v'},
                                    {"log",      required_argument, nullptr, 'l'},
                                    {"defaults", no_argument,       nullptr, 1},
+                                   {"jobs",     required_argument, nullptr, 'j'},
                                    {"help",     no_argument,       nullptr, 'h'},
                                    {nullptr,    0,           nullptr, 0}};
 
-    while ((option = getopt_long(argc, argv, "vhgfc:l:", opts, &option_index)) != EOF) {
+    while ((option = getopt_long(argc, argv, "vhgfc:l:j:", opts, &option_index)) != EOF) {
         switch (option) {
             case 'g':
                 options.global = true;
@@ -78,17 +88,34 @@ int main(int argc, char *const argv[]) {
                     return PREP_FAILURE;
                 }
                 break;
+            case 'j':
+                options.jobs = static_cast<unsigned>(atoi(optarg));
+                break;
             case 'h':
                 print_help(options);
                 return PREP_FAILURE;
             case 1:
                 options.defaults = true;
                 break;
+            case 2:
+                hook = optarg;
+                break;
+            case 3:
+                options.isolate = true;
+                break;
+            case 4:
+                follow = true;
+                break;
             default:
                 break;
         }
     }
 
+    // started by another prep to empty a trash folder, see filesystem::empty_trash
+    if (const char *trash = getenv(filesystem::TRASH_VARIABLE)) {
+        return Repository::remove_trash(trash);
+    }
+
     try {
         if (prep.initialize(options) != PREP_SUCCESS) {
             return PREP_FAILURE;
@@ -168,6 +195,30 @@ int main(int argc, char *const argv[]) {
         return prep.plugins(options, argc - optind, &argv[optind]);
     }
 
+    if (string::equals(command, "logs")) {
+        // -f follows the log here, there is nothing to build
+        if (options.force_build == ForceLevel::All) {
+            follow = true;
+        }
+
+        if (optind < argc) {
+            return prep.logs(argv[optind], hook, follow);
+        }
+
+        PackageConfig config;
+
+        if (config.load(options.location, options) == PREP_FAILURE) {
+            log::error("unable to load config for ", options.location);
+            return PREP_FAILURE;
+        }
+
+        return prep.logs(config.name(), hook, follow);
+    }
+
+    if (string::equals(command, "gc")) {
+        return prep.gc(options);
+    }
+
     try {
         if (prep.load(options) != PREP_SUCCESS) {
             return PREP_FAILURE;
@@ -178,6 +229,11 @@ int main(int argc, char *const argv[]) {
         return PREP_FAILURE;
     }
 
+    // make room before anything is fetched or built, if the repository asks for it
+    if (prep.gc(options, true) != PREP_SUCCESS) {
+        log::warn("unable to collect all garbage");
+    }
+
     if (string::equals(command, "cleanup") || string::equals(command, "clean")) {
         PackageConfig config;
 
@@ -37,6 +37,10 @@ namespace micrantha {
             Verbosity verbose;
             // accept default options
             bool defaults;
+            // the most plugin hooks to run at once, zero for a default
+            unsigned jobs;
+            // build against dependency install prefixes instead of the repository
+            bool isolate;
             // the binary name
             char *exe;
         } Options;
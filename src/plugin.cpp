@@ -1,15 +1,13 @@
 
-#ifndef __APPLE__
-#include <pty.h>
-#else
+#include <dlfcn.h>
 #include <termios.h>
-#include <util.h>
-#endif
-
 #include <sys/wait.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <fstream>
+#include <limits>
 #include <sstream>
 #include <thread>
 #include <vector>
@@ -17,14 +15,31 @@
 #include "common.h"
 #include "environment.h"
 #include "log.h"
+#include "log_file.h"
 #include "package.h"
 #include "plugin.h"
+#include "prep_plugin.h"
+#include "protocol.h"
+
+extern char **environ;
 
 namespace micrantha {
   namespace prep {
     namespace internal {
       constexpr const char *const END_HEADER = "END";
 
+      // set in the environment of a plugin started as a persistent worker
+      constexpr const char *const WORKER_ENV = "PREP_WORKER";
+
+      // set in the environment of a plugin to the descriptor its request file is on
+      constexpr const char *const REQUEST_ENV = "PREP_REQUEST_FD";
+
+      // the number of log lines shown when a hook fails
+      constexpr const size_t LOG_TAIL_LINES = 20;
+
+      // logs older than this are from an earlier run and are replaced
+      const auto START_TIME = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
       constexpr const char *const TYPE_NAMES[] = {"internal", "configuration", "dependency", "resolver", "build"};
 
       std::string to_string(Plugin::Hooks hook) {
@@ -65,21 +80,21 @@ namespace micrantha {
 
       // writes a header to the parent process, resulting as input to child process
       int write_header(int fd, const std::string &method, const std::vector<std::string> &info) {
+        // the whole header goes out in one write
+        io::LineWriter writer(fd, std::numeric_limits<size_t>::max());
+
         // write the hook method to the plugin (child)
-        if (io::write_line(fd, method) < 0) {
-          return PREP_FAILURE;
-        }
+        writer.write_line(method);
 
         // for each additional argument...
         for (auto &i : info) {
-          // write to the child
-          if (io::write_line(fd, i) < 0) {
-            return PREP_FAILURE;
-          }
+          writer.write_line(i);
         }
 
         // write the header terminator
-        if (io::write_line(fd, END_HEADER) < 0) {
+        writer.write_line(END_HEADER);
+
+        if (writer.flush() < 0) {
           return PREP_FAILURE;
         }
 
@@ -93,114 +108,787 @@ namespace micrantha {
        public:
         std::vector<std::string> returns;
 
-        Interpreter(bool verbose = false) : verbose_(verbose), failure_(false), emitting_(false) {
-          tcgetattr(STDIN_FILENO, &term_);
+        std::vector<std::string> artifacts;
+
+        /**
+         * @param verbose true if plain output should be forwarded
+         * @param terminal true if the plugin is on a terminal and may change its settings
+         * @param version the protocol version the plugin speaks
+         * @param prefix put before forwarded lines, when output is shared with other plugins
+         * @param worker true if the plugin is a persistent worker, which ends each request with DONE
+         */
+        Interpreter(bool verbose = false, bool terminal = true, int version = 1, std::string prefix = "",
+                    bool worker = false)
+            : verbose_(verbose), terminal_(terminal), worker_(worker), failure_(false), emitting_(false), done_(false),
+              code_(PREP_SUCCESS), version_(version), progress_(-1), prefix_(std::move(prefix)),
+              out_(STDOUT_FILENO), err_(STDERR_FILENO), log_(nullptr) {
+          if (terminal_) {
+            tcgetattr(STDIN_FILENO, &term_);
+          }
+        }
+
+        ~Interpreter() {
+          flush();
+
+          if (terminal_) {
+            tcsetattr(STDIN_FILENO, TCSAFLUSH, &term_);
+          }
+        }
+
+        // writes any output waiting to be forwarded
+        void flush() {
+          out_.flush();
+          err_.flush();
+        }
+
+        /**
+         * @return the milliseconds until forwarded output must be flushed, or -1 if none is waiting
+         */
+        long due() const {
+          auto out = out_.due(), err = err_.due();
+
+          return out < 0 ? err : (err < 0 ? out : std::min(out, err));
         }
 
-        ~Interpreter() { tcsetattr(STDIN_FILENO, TCSAFLUSH, &term_); }
+        /**
+         * @param log where output is kept, whether or not it is forwarded
+         */
+        void set_log(log::File *log) { log_ = log; }
 
         void reset() {
           if (emitting_) {
+            flush();
             emitting_ = false;
-            tcsetattr(STDIN_FILENO, TCSANOW, &term_);
+            if (terminal_) {
+              tcsetattr(STDIN_FILENO, TCSANOW, &term_);
+            }
             ::write(STDOUT_FILENO, "\n", 1);
           }
         }
 
         /**
-         * @return true if line should be output
+         * @param frame a message from a plugin speaking the framed protocol
          */
-        int interpret(const std::string &line) {
-          auto res = on_command(line, "RETURN", [this](const std::string &args) { returns.push_back(args); });
+        int interpret(const protocol::Frame &frame) {
+          switch (frame.type) {
+            case protocol::Type::RETURN:
+              returns.push_back(frame.payload);
+              break;
+            case protocol::Type::DONE:
+              // a plugin that is not a worker is read until it exits
+              if (!worker_) {
+                log::debug("ignoring DONE frame from plugin that is not a worker");
+                break;
+              }
+              done_ = true;
+              code_ = frame.payload.empty() ? PREP_SUCCESS : atoi(frame.payload.c_str());
+              break;
+            case protocol::Type::LOG:
+              keep(frame.payload);
+              if (out_.write_line("  " + prefix_ + frame.payload) < 0) {
+                failure_ = true;
+              }
+              break;
+            case protocol::Type::OUTPUT:
+              keep(frame.payload);
+              if (verbose_ && out_.write_line(prefix_ + frame.payload) < 0) {
+                return PREP_ERROR;
+              }
+              break;
+            case protocol::Type::ERROR:
+              keep(frame.payload, "ERROR ");
+              flush();
+              log::error(prefix_, frame.payload);
+              failure_ = true;
+              break;
+            case protocol::Type::PROGRESS: {
+              // a percentage, optionally followed by what is being done
+              char *message = nullptr;
 
-          if (res) {
-            return failure() ? PREP_FAILURE : PREP_SUCCESS;
-          }
+              progress_ = static_cast<int>(strtol(frame.payload.c_str(), &message, 10));
 
-          res = on_command(line, "ECHO", [this](const std::string &args) {
-            if (io::write_line(STDOUT_FILENO, "  " + args) < 0) {
-              failure_ = true;
-            }
-          });
+              if (*message == ' ') {
+                keep(frame.payload);
+              }
 
-          if (res) {
-            return failure() ? PREP_FAILURE : PREP_SUCCESS;
+              if (verbose_ && *message == ' ') {
+                out_.write_line("  " + prefix_ + "[" + std::to_string(progress_) + "%]" + message);
+              }
+              break;
+            }
+            case protocol::Type::ARTIFACT:
+              artifacts.push_back(frame.payload);
+              break;
+            default:
+              log::debug("ignoring ", protocol::to_string(frame.type), " frame from plugin");
+              break;
           }
 
-          res = on_command(line, "ERROR", [this](const std::string &args) {
-            log::error(args);
-            failure_ = true;
-          });
+          return failure() ? PREP_FAILURE : PREP_SUCCESS;
+        }
 
-          if (res) {
-            return failure() ? PREP_FAILURE : PREP_SUCCESS;
+        /**
+         * @param line the line of plugin output
+         * @param fd where the line is forwarded if it should be output
+         */
+        int interpret(const std::string &line, int fd = STDOUT_FILENO) {
+          // commands only come in frames, anything else is plain output
+          if (framed()) {
+            return forward(line, fd);
           }
 
-          res = on_command(line, "EMIT", [this](const std::string &args) {
-            emitting_ = true;
+          std::string_view args;
 
-            if (args.length() > 0) {
-              if (io::write(STDOUT_FILENO, args) < 0) {
+          switch (protocol::classify(line, args)) {
+            case protocol::Command::RETURN:
+              returns.emplace_back(args);
+              break;
+            case protocol::Command::DONE:
+              // only a worker answers with DONE, for anything else it is output ("Done building")
+              if (!worker_) {
+                return forward(line, fd);
+              }
+              done_ = true;
+              code_ = args.empty() ? PREP_SUCCESS : atoi(std::string(args).c_str());
+              break;
+            case protocol::Command::LOG:
+              keep(args);
+              if (out_.write_line("  " + prefix_, args) < 0) {
                 failure_ = true;
               }
-            }
-
-            struct termios t = term_;
-            t.c_lflag &= ~ECHO;
-            if (tcsetattr(STDIN_FILENO, TCSANOW, &t)) {
+              break;
+            case protocol::Command::ERROR:
+              keep(args, "ERROR ");
+              flush();
+              log::error(prefix_, args);
               failure_ = true;
-            }
-          });
-
-          if (res) {
-            return failure() ? PREP_FAILURE : PREP_SUCCESS;
-          }
-
-          if (verbose_ || emitting_) {
-            if (io::write_line(STDOUT_FILENO, line) < 0) {
-              return PREP_ERROR;
-            }
-            return PREP_SUCCESS;
+              break;
+            case protocol::Command::EMIT:
+              emit(args);
+              break;
+            default:
+              return forward(line, fd);
           }
 
-          return PREP_SUCCESS;
+          return failure() ? PREP_FAILURE : PREP_SUCCESS;
         }
 
         bool failure() const { return failure_; }
         bool emitting() const { return emitting_; }
+        // the plugin speaks in frames
+        bool framed() const { return version_ >= protocol::FRAMED; }
+        int version() const { return version_; }
+        // the last reported progress percentage, or -1
+        int progress() const { return progress_; }
+        protocol::Parser &parser() { return parser_; }
+        // a worker has answered the current request
+        bool done() const { return done_; }
+        int code() const { return code_; }
 
        private:
         bool verbose_;
+        bool terminal_;
+        bool worker_;
         bool failure_;
         bool emitting_;
+        bool done_;
+        int code_;
+        int version_;
+        int progress_;
+        protocol::Parser parser_;
+        std::string prefix_;
         struct termios term_;
+        // batches forwarded output
+        io::LineWriter out_;
+        io::LineWriter err_;
+        log::File *log_;
+
+        // adds a line to the log, if there is one
+        void keep(std::string_view line, std::string_view prefix = std::string_view()) {
+          if (log_ == nullptr) {
+            return;
+          }
+
+          if (prefix.empty()) {
+            log_->write_line(line);
+          } else {
+            log_->write_line(std::string(prefix).append(line));
+          }
+        }
+
+        // writes a line of plain output, if it should be output
+        int forward(const std::string &line, int fd) {
+          keep(line);
 
-        struct cmd {
-          std::string name;
-          int args_pos;
-          std::string args;
-          bool valid;
-        };
+          if (!verbose_ && !emitting_) {
+            return PREP_SUCCESS;
+          }
+
+          if ((fd == STDERR_FILENO ? err_ : out_).write_line(prefix_, line) < 0) {
+            return PREP_ERROR;
+          }
 
-        static struct cmd parse_command(const std::string &line, const std::string &command) {
-          int pos = command.length();
-          bool valid = !strcasecmp(line.substr(0, pos).c_str(), command.c_str());
-          auto args = ++pos < line.length() ? line.substr(pos) : "";
-          return {command, pos, args, valid};
+          return PREP_SUCCESS;
         }
 
-        bool on_command(const std::string &line, const std::string &command,
-                        const std::function<void(const std::string &)> &callback) {
-          auto cmd = parse_command(line, command);
+        // shows a prompt and hides user input until the plugin answers
+        void emit(std::string_view args) {
+          // a prompt can not be answered when output is shared
+          if (!prefix_.empty()) {
+            if (out_.write_line(prefix_, args) < 0) {
+              failure_ = true;
+            }
+            return;
+          }
+
+          emitting_ = true;
+
+          // a prompt goes out right away
+          flush();
+
+          if (args.length() > 0) {
+            if (io::write(STDOUT_FILENO, std::string(args)) < 0) {
+              failure_ = true;
+            }
+          }
+
+          if (!terminal_) {
+            return;
+          }
+
+          struct termios t = term_;
+          t.c_lflag &= ~ECHO;
+          if (tcsetattr(STDIN_FILENO, TCSANOW, &t)) {
+            failure_ = true;
+          }
+        }
+      };  // namespace internal
 
-          if (!cmd.valid) {
+      /**
+       * limits how long a hook may run and how long it may go without output.  once a limit is
+       * passed the plugin's process group is asked to terminate, and killed if it is still
+       * around after a grace period.
+       */
+      class Watchdog {
+       public:
+        typedef std::chrono::steady_clock clock;
+
+        // how long a plugin has to exit after being asked to
+        constexpr static const long GRACE = 5000;
+
+        /**
+         * @param timeout the milliseconds a hook may run, or zero for no limit
+         * @param stall the milliseconds a hook may go without output, or zero for no limit
+         */
+        Watchdog(long timeout, long stall)
+            : timeout_(timeout), stall_(stall), code_(PREP_SUCCESS), killed_(false), started_(clock::now()),
+              touched_(started_) {}
+
+        // the plugin has shown signs of life
+        void touch() { touched_ = clock::now(); }
+
+        /**
+         * @return the milliseconds until enforce must be called, or -1 if never
+         */
+        long due() const {
+          if (killed_) {
+            return -1;
+          }
+
+          if (code_ != PREP_SUCCESS) {
+            return remaining(signalled_, GRACE);
+          }
+
+          long due = -1;
+
+          if (timeout_ > 0) {
+            due = remaining(started_, timeout_);
+          }
+
+          if (stall_ > 0) {
+            auto stall = remaining(touched_, stall_);
+
+            due = due < 0 ? stall : std::min(due, stall);
+          }
+
+          return due;
+        }
+
+        /**
+         * terminates the plugin if a limit has passed, or kills it if the grace period has passed
+         * @return true if the plugin is being terminated
+         */
+        bool enforce(const std::string &name, pid_t pid) {
+          if (killed_) {
+            return true;
+          }
+
+          if (code_ != PREP_SUCCESS) {
+            if (remaining(signalled_, GRACE) == 0) {
+              log::error(name, " did not terminate, killing");
+              kill(-pid, SIGKILL);
+              killed_ = true;
+            }
+            return true;
+          }
+
+          if (timeout_ > 0 && remaining(started_, timeout_) == 0) {
+            log::error(name, " timed out after ", timeout_ / 1000.0, "s");
+            code_ = process::TimedOut;
+          } else if (stall_ > 0 && remaining(touched_, stall_) == 0) {
+            log::error(name, " stalled with no output for ", stall_ / 1000.0, "s");
+            code_ = process::Stalled;
+          } else {
             return false;
           }
 
-          callback(cmd.args);
+          // plugins run in their own session, so this reaches anything they started
+          kill(-pid, SIGTERM);
+          signalled_ = clock::now();
           return true;
         }
-      };  // namespace internal
+
+        /**
+         * waits for a plugin to exit, terminating it if a limit passes and killing it if it takes too long
+         * @return the process id or -1 on error
+         */
+        pid_t wait(const std::string &name, pid_t pid, int *status) {
+          pid_t rval;
+
+          // a plugin that stops is reported until it is being terminated
+          while (!killed_ && (rval = waitpid(pid, status, WNOHANG | (code_ == PREP_SUCCESS ? WUNTRACED : 0))) == 0) {
+            auto due = this->due();
+
+            // no limits to enforce
+            if (due < 0) {
+              return waitpid(pid, status, WUNTRACED);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min<long>(due, 100)));
+            enforce(name, pid);
+          }
+
+          return killed_ ? waitpid(pid, status, 0) : rval;
+        }
+
+        /**
+         * @return TimedOut or Stalled if a limit was passed, otherwise PREP_SUCCESS
+         */
+        int code() const { return code_; }
+
+       private:
+        // the milliseconds left of a period that began at a point in time
+        static long remaining(clock::time_point since, long period) {
+          auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - since).count();
+
+          return std::max<long>(0, period - elapsed);
+        }
+
+        long timeout_;
+        long stall_;
+        int code_;
+        bool killed_;
+        clock::time_point started_;
+        clock::time_point touched_;
+        clock::time_point signalled_;
+      };
+
+      /**
+       * reads a time limit for a hook from a plugin manifest, either one number of seconds for every
+       * hook or an object of seconds by hook name
+       * @return the limit in milliseconds, or zero for none
+       */
+      long get_limit(const Package::json_type &config, const char *key, const Plugin::Hooks &hook) {
+        auto entry = config.find(key);
+
+        if (entry == config.end()) {
+          return 0;
+        }
+
+        auto value = *entry;
+
+        if (value.is_object()) {
+          auto it = value.find(to_string(hook));
+
+          if (it == value.end()) {
+            return 0;
+          }
+          value = *it;
+        }
+
+        if (!value.is_number() || value.get<double>() <= 0) {
+          return 0;
+        }
+
+        return static_cast<long>(value.get<double>() * 1000);
+      }
+
+      // the time limits a plugin manifest sets for a hook
+      Watchdog get_watchdog(const Package::json_type &config, const Plugin::Hooks &hook) {
+        return Watchdog(get_limit(config, "timeout", hook), get_limit(config, "stall_timeout", hook));
+      }
+
+      // converts an exit code from a plugin into a result code
+      int to_result_code(int rval, const Interpreter &interpreter) {
+        if (rval == 0 && interpreter.failure()) {
+          rval = process::NotAvailable;
+        }
+        // typically rval will be the return status of the command the plugin executes, 255 = -1
+        return rval == 255 ? PREP_ERROR : rval;
+      }
+
+      // the result of a plugin that exited with a code
+      Plugin::Result to_result(int rval, const Interpreter &interpreter) {
+        return {to_result_code(rval, interpreter), interpreter.returns, interpreter.artifacts};
+      }
+
+      /**
+       * reads a block of plugin output and interprets each complete line
+       * @param worker true if a failure should not stop the interpreter
+       * @return true if the descriptor is still open
+       */
+      bool interpret_lines(io::LineReader &reader, Interpreter &interpreter, int output, bool worker) {
+        std::string line;
+
+        ssize_t n = reader.fill();
+
+        if (n < 0) {
+          log::perror("read");
+          return false;
+        }
+
+        if (interpreter.framed() && output == STDOUT_FILENO) {
+          protocol::Frame frame;
+          int rval = PREP_SUCCESS;
+
+          while (!interpreter.done() && (worker || !interpreter.failure()) &&
+                 (rval = interpreter.parser().next(reader, frame)) == PREP_SUCCESS) {
+            if (interpreter.interpret(frame) == PREP_ERROR) {
+              log::perror("interpret");
+              return false;
+            }
+          }
+
+          if (rval == PREP_ERROR) {
+            log::error("invalid frame from plugin");
+            return false;
+          }
+
+          return !reader.eof();
+        }
+
+        while (!interpreter.done() && (worker || !interpreter.failure()) && reader.next(line)) {
+          if (interpreter.interpret(line, output) == PREP_ERROR) {
+            log::perror("interpret");
+            return false;
+          }
+        }
+
+        return !reader.eof();
+      }
+
+      /**
+       * writes the header of a request to a plugin
+       * @return PREP_SUCCESS or PREP_ERROR if the request could not be sent
+       */
+      int send_request(const std::string &name, int fd, const Plugin::Hooks &hook,
+                       const std::vector<std::string> &info, int version) {
+        auto method = to_string(hook);
+
+        log::trace("executing [", method, "] on plugin [", name, "]");
+
+        for (auto it = info.begin(); it != info.end(); ++it) {
+          log::trace("param: ", *it);
+        }
+
+        if (version >= protocol::FRAMED) {
+          if (protocol::write_request(fd, method, info) == PREP_FAILURE) {
+            log::perror("write_request");
+            return PREP_ERROR;
+          }
+          return PREP_SUCCESS;
+        }
+
+        if (write_header(fd, method, info) == PREP_FAILURE) {
+          log::perror("write_header");
+          return PREP_ERROR;
+        }
+
+        return PREP_SUCCESS;
+      }
+
+      /**
+       * writes a request to a file that is handed to a plugin
+       * @return the sealed file or -1 on error
+       */
+      int write_request_file(const std::string &name, const Plugin::Hooks &hook, const std::vector<std::string> &info,
+                             int version) {
+        int fd = io::temporary_file("prep-request");
+
+        if (fd < 0) {
+          log::perror("temporary_file");
+          return -1;
+        }
+
+        if (send_request(name, fd, hook, info, version) == PREP_ERROR) {
+          ::close(fd);
+          return -1;
+        }
+
+        if (io::seal_file(fd) == PREP_ERROR) {
+          log::perror("seal_file");
+          ::close(fd);
+          return -1;
+        }
+
+        return fd;
+      }
+
+      /**
+       * interprets the output of a plugin that has been sent a request until it exits or,
+       * for a worker, answers the request.  stops early if the watchdog terminates the plugin.
+       */
+      void communicate(const std::string &name, const process::Child &child, Interpreter &interpreter,
+                       Watchdog &watchdog, bool worker) {
+        // user input would be mixed up with frames
+        bool input = !interpreter.framed();
+        bool output = true;
+        bool error = child.error != -1;
+
+        io::LineReader outputReader(child.output);
+        io::LineReader errorReader(child.error);
+
+        // start the io loop with child, a worker is read until it answers
+        while (output && !interpreter.done() && (worker || !interpreter.failure())) {
+          // a plugin that keeps printing never lets select time out
+          if (watchdog.due() == 0 && watchdog.enforce(name, child.pid)) {
+            break;
+          }
+
+          fd_set read_fd = {};
+          std::string line;
+
+          FD_ZERO(&read_fd);
+
+          FD_SET(child.output, &read_fd);
+
+          int nfds = child.output;
+
+          if (error) {
+            FD_SET(child.error, &read_fd);
+            nfds = std::max(nfds, child.error);
+          }
+
+          if (input) {
+            FD_SET(STDIN_FILENO, &read_fd);
+          }
+
+          struct timeval timeout = {}, *wait = nullptr;
+
+          // wake up in time to forward output that is waiting, or to enforce a time limit
+          auto due = interpreter.due(), limit = watchdog.due();
+
+          if (due < 0 || (limit >= 0 && limit < due)) {
+            due = limit;
+          }
+
+          if (due >= 0) {
+            timeout.tv_sec = due / 1000;
+            timeout.tv_usec = (due % 1000) * 1000;
+            wait = &timeout;
+          }
+
+          // wait for something to happen
+          int ready = select(nfds + 1, &read_fd, nullptr, nullptr, wait);
+
+          if (ready < 0) {
+            if (errno == EINTR) {
+              continue;
+            }
+            log::perror("select");
+            break;
+          }
+
+          if (ready == 0) {
+            interpreter.flush();
+
+            if (watchdog.enforce(name, child.pid)) {
+              break;
+            }
+            continue;
+          }
+
+          // if we have something to read from child...
+          if (FD_ISSET(child.output, &read_fd)) {
+            output = interpret_lines(outputReader, interpreter, STDOUT_FILENO, worker);
+            watchdog.touch();
+          }
+
+          if (error && FD_ISSET(child.error, &read_fd)) {
+            error = interpret_lines(errorReader, interpreter, STDERR_FILENO, worker);
+            watchdog.touch();
+          }
+
+          // if we have something to read on stdin...
+          if (input && FD_ISSET(STDIN_FILENO, &read_fd)) {
+            ssize_t n = io::read_line(STDIN_FILENO, line);
+
+            interpreter.reset();
+
+            // no more input, keep reading the child
+            if (n == 0) {
+              input = false;
+              continue;
+            }
+
+            if (n < 0) {
+              log::perror("read_line");
+              break;
+            }
+
+            // send it to the child
+            if (io::write_line(child.input, line) < 0) {
+              log::perror("write_line");
+              break;
+            }
+          }
+        }
+
+        // drain anything the child left until it closes its output, still within the time limits
+        while ((output || error) && !worker && watchdog.code() == PREP_SUCCESS) {
+          if (watchdog.due() == 0 && watchdog.enforce(name, child.pid)) {
+            break;
+          }
+
+          fd_set read_fd = {};
+
+          FD_ZERO(&read_fd);
+
+          int nfds = -1;
+
+          if (output) {
+            FD_SET(child.output, &read_fd);
+            nfds = child.output;
+          }
+
+          if (error) {
+            FD_SET(child.error, &read_fd);
+            nfds = std::max(nfds, child.error);
+          }
+
+          struct timeval timeout = {}, *wait = nullptr;
+
+          auto due = watchdog.due();
+
+          if (due >= 0) {
+            timeout.tv_sec = due / 1000;
+            timeout.tv_usec = (due % 1000) * 1000;
+            wait = &timeout;
+          }
+
+          int ready = select(nfds + 1, &read_fd, nullptr, nullptr, wait);
+
+          if (ready < 0) {
+            if (errno == EINTR) {
+              continue;
+            }
+            log::perror("select");
+            break;
+          }
+
+          if (ready == 0) {
+            if (watchdog.enforce(name, child.pid)) {
+              break;
+            }
+            continue;
+          }
+
+          if (output && FD_ISSET(child.output, &read_fd)) {
+            output = interpret_lines(outputReader, interpreter, STDOUT_FILENO, worker);
+            watchdog.touch();
+          }
+
+          if (error && FD_ISSET(child.error, &read_fd)) {
+            error = interpret_lines(errorReader, interpreter, STDERR_FILENO, worker);
+            watchdog.touch();
+          }
+        }
+
+        interpreter.flush();
+      }
+
+      /**
+       * converts how a plugin process exited into a result
+       * @param status the wait status of the plugin process
+       * @return the result of the plugin
+       */
+      Plugin::Result to_result(const std::string &name, int status, const Interpreter &interpreter) {
+        // check exit status of child
+        if (WIFEXITED(status)) {
+          // convert the exit status to a return value
+          return to_result(WEXITSTATUS(status), interpreter);
+        } else if (WIFSIGNALED(status)) {
+          int sig = WTERMSIG(status);
+
+          // log signals
+          log::error(name, " terminated signal ", sig);
+
+          // and core dump
+          if (WCOREDUMP(status)) {
+            log::error(name, " produced core dump");
+          }
+        } else if (WIFSTOPPED(status)) {
+          int sig = WSTOPSIG(status);
+
+          log::error(name, " stopped signal ", sig);
+        } else {
+          log::error(name, " did not exit cleanly");
+        }
+
+        return PREP_FAILURE;
+      }
+
+      /**
+       * waits for a plugin process to exit
+       * @return the result of the plugin
+       */
+      Plugin::Result wait_for(const std::string &name, pid_t pid, const Interpreter &interpreter,
+                              Watchdog &watchdog) {
+        int status = 0;
+
+        // wait for the child to exit, a child that closed its output can still run past a limit
+        pid = watchdog.wait(name, pid, &status);
+
+        if (pid == -1) {
+          log::perror("error waiting for plugin");
+          return PREP_FAILURE;
+        }
+
+        if (watchdog.code() != PREP_SUCCESS) {
+          return watchdog.code();
+        }
+
+        return to_result(name, status, interpreter);
+      }
+
+      // passes a message from a shared plugin to the interpreter of the running hook
+      void send_message(prep_context *context, prep_message type, const char *payload, size_t length) {
+        static const protocol::Type TYPES[] = {protocol::Type::RETURN, protocol::Type::LOG,
+                                               protocol::Type::OUTPUT, protocol::Type::ERROR,
+                                               protocol::Type::PROGRESS, protocol::Type::ARTIFACT};
+
+        protocol::Frame frame;
+
+        if (type >= 0 && type < sizeof(TYPES) / sizeof(TYPES[0])) {
+          frame.type = TYPES[type];
+        }
+
+        if (payload != nullptr) {
+          frame.payload.assign(payload, length);
+        }
+
+        static_cast<Interpreter *>(context->prep)->interpret(frame);
+      }
 
       std::string get_plugin_string(const std::string &plugin, const std::string &key, const Package &config) {
         auto json = config.get_value(plugin);
@@ -230,15 +918,33 @@ namespace micrantha {
       return out;
     }
 
-    Plugin::Plugin(const std::string &name) : name_(name), type_(Types::INTERNAL), enabled_(true) {}
-
-    Plugin::~Plugin() { on_unload(); }
+    Plugin::Plugin(const std::string &name)
+        : name_(name),
+          type_(Types::INTERNAL),
+          enabled_(true),
+          persistent_(false),
+          interactive_(true),
+          protocol_(1),
+          requestFile_(false),
+          shared_(false) {}
+
+    Plugin::~Plugin() {
+      on_unload();
+      stop_worker();
+    }
 
     Plugin &Plugin::set_verbose(bool value) {
       verbose_ = value;
       return *this;
     }
 
+    Plugin &Plugin::set_log_path(const std::string &path) {
+      logPath_ = path;
+      return *this;
+    }
+
+    std::string Plugin::hook_name(const Hooks &hook) { return internal::to_string(hook); }
+
     Plugin &Plugin::set_enabled(bool value) {
       config_["enabled"] = enabled_ = value;
       return *this;
@@ -271,26 +977,56 @@ namespace micrantha {
 
       auto entry = config_["type"];
 
-      if (entry.is_string()) {
-        type_ = internal::to_type(entry.get<std::string>());
+      if (entry.is_string()) {
+        type_ = internal::to_type(entry.get<std::string>());
+      }
+
+      entry = config_["version"];
+
+      if (entry.is_string()) {
+        version_ = entry.get<std::string>();
+      }
+
+      entry = config_["priority"];
+
+      if (entry.is_number()) {
+        priority_ = entry.get<int>();
+      }
+
+      entry = config_["enabled"];
+
+      if (entry.is_boolean()) {
+        enabled_ = entry.get<bool>();
+      }
+
+      entry = config_["persistent"];
+
+      if (entry.is_boolean()) {
+        persistent_ = entry.get<bool>();
       }
 
-      entry = config_["version"];
+      entry = config_["interactive"];
 
-      if (entry.is_string()) {
-        version_ = entry.get<std::string>();
+      if (entry.is_boolean()) {
+        interactive_ = entry.get<bool>();
       }
 
-      entry = config_["priority"];
+      entry = config_["protocol"];
 
       if (entry.is_number()) {
-        priority_ = entry.get<int>();
+        protocol_ = entry.get<int>();
       }
 
-      entry = config_["enabled"];
+      entry = config_["request_file"];
 
       if (entry.is_boolean()) {
-        enabled_ = entry.get<bool>();
+        requestFile_ = entry.get<bool>();
+      }
+
+      entry = config_["kind"];
+
+      if (entry.is_string()) {
+        shared_ = entry.get<std::string>() == "shared";
       }
 
       entry = config_["executable"];
@@ -299,6 +1035,12 @@ namespace micrantha {
         executablePath_ = filesystem::build_path(basePath_, entry.get<std::string>());
       }
 
+      entry = config_["library"];
+
+      if (entry.is_string()) {
+        libraryPath_ = filesystem::build_path(basePath_, entry.get<std::string>());
+      }
+
       return PREP_SUCCESS;
     }
 
@@ -323,6 +1065,10 @@ namespace micrantha {
 
       read_config();
 
+      if (shared_) {
+        return load_library();
+      }
+
       if (executablePath_.empty() && type_ != Types::INTERNAL) {
         log::error("plugin [", name_, "] has no executable");
         return PREP_FAILURE;
@@ -333,7 +1079,40 @@ namespace micrantha {
 
     bool Plugin::is_enabled() const { return enabled_; }
 
-    bool Plugin::is_valid() const { return filesystem::is_file_executable(executablePath_); }
+    int Plugin::load_library() {
+      if (libraryPath_.empty()) {
+        log::error("plugin [", name_, "] has no library");
+        return PREP_FAILURE;
+      }
+
+      void *library = dlopen(libraryPath_.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+      if (library == nullptr) {
+        log::error("unable to load plugin [", name_, "]: ", dlerror());
+        return PREP_FAILURE;
+      }
+
+      library_ = std::shared_ptr<void>(library, dlclose);
+
+      auto abi = reinterpret_cast<prep_plugin_abi_version>(dlsym(library, PREP_PLUGIN_ABI_SYMBOL));
+
+      if (abi == nullptr || abi() != PREP_PLUGIN_ABI) {
+        log::error("plugin [", name_, "] does not support plugin abi ", PREP_PLUGIN_ABI);
+        library_ = nullptr;
+        return PREP_FAILURE;
+      }
+
+      return PREP_SUCCESS;
+    }
+
+    bool Plugin::is_valid() const {
+      if (shared_) {
+        return library_ != nullptr;
+      }
+      return filesystem::is_file_executable(executablePath_);
+    }
+
+    bool Plugin::is_shared() const { return shared_; }
 
     std::string Plugin::name() const { return name_; }
 
@@ -372,11 +1151,21 @@ namespace micrantha {
 
       std::vector<std::string> info = {internal::get_plugin_string(name(), "name", config), config.version(), path};
 
-      return execute(Hooks::ADD, info);
+      return execute(Hooks::ADD, info, config.name());
     }
 
     Plugin::Result Plugin::on_resolve(const Package &config, const std::string &sourcePath) const {
-      return on_resolve(internal::get_plugin_string(name(), "location", config), sourcePath);
+      if (!is_valid() || !is_enabled()) {
+        return PREP_ERROR;
+      }
+
+      if (type_ != Types::RESOLVER) {
+        return PREP_ERROR;
+      }
+
+      std::vector<std::string> info = {sourcePath, internal::get_plugin_string(name(), "location", config)};
+
+      return execute(Hooks::RESOLVE, info, config.name());
     }
 
     Plugin::Result Plugin::on_resolve(const std::string &location, const std::string &sourcePath) const {
@@ -393,6 +1182,20 @@ namespace micrantha {
       return execute(Hooks::RESOLVE, info);
     }
 
+    std::shared_ptr<Plugin::Job> Plugin::start_resolve(const Package &config, const std::string &sourcePath) const {
+      if (!is_valid() || !is_enabled()) {
+        return nullptr;
+      }
+
+      if (type_ != Types::RESOLVER) {
+        return nullptr;
+      }
+
+      std::vector<std::string> info = {sourcePath, internal::get_plugin_string(name(), "location", config)};
+
+      return start(Hooks::RESOLVE, info, config.name());
+    }
+
     Plugin::Result Plugin::on_remove(const Package &config, const std::string &path) const {
       if (!is_valid() || !is_enabled()) {
         return PREP_ERROR;
@@ -404,11 +1207,11 @@ namespace micrantha {
 
       std::vector<std::string> info = {internal::get_plugin_string(name(), "name", config), config.version(), path};
 
-      return execute(Hooks::REMOVE, info);
+      return execute(Hooks::REMOVE, info, config.name());
     }
 
     Plugin::Result Plugin::on_build(const Package &config, const std::string &sourcePath, const std::string &buildPath,
-                                    const std::string &installPath) const {
+                                    const std::string &installPath, const environment::Snapshot &env) const {
       if (!is_valid() || !is_enabled()) {
         return PREP_ERROR;
       }
@@ -422,15 +1225,13 @@ namespace micrantha {
       std::vector<std::string> info({internal::get_plugin_string(name(), "name", config), config.version(), sourcePath,
                                      buildPath, installPath, config.build_options()});
 
-      auto env = environment::build_env();
-
-      info.insert(info.end(), env.begin(), env.end());
+      info.insert(info.end(), env.build_env().begin(), env.build_env().end());
 
-      return execute(Hooks::BUILD, info);
+      return execute(Hooks::BUILD, info, config.name());
     }
 
     Plugin::Result Plugin::on_test(const Package &config, const std::string &sourcePath,
-                                   const std::string &buildPath) const {
+                                   const std::string &buildPath, const environment::Snapshot &env) const {
       if (!is_valid() || !is_enabled()) {
         return PREP_ERROR;
       }
@@ -444,15 +1245,13 @@ namespace micrantha {
       std::vector<std::string> info(
           {internal::get_plugin_string(name(), "name", config), config.version(), sourcePath, buildPath});
 
-      auto env = environment::build_env();
+      info.insert(info.end(), env.build_env().begin(), env.build_env().end());
 
-      info.insert(info.end(), env.begin(), env.end());
-
-      return execute(Hooks::TEST, info);
+      return execute(Hooks::TEST, info, config.name());
     }
 
     Plugin::Result Plugin::on_install(const Package &config, const std::string &installPath,
-                                      const std::string &buildPath) const {
+                                      const std::string &buildPath, const environment::Snapshot &env) const {
       if (!is_valid() || !is_enabled()) {
         return PREP_ERROR;
       }
@@ -466,162 +1265,389 @@ namespace micrantha {
       std::vector<std::string> info(
           {internal::get_plugin_string(name(), "name", config), config.version(), installPath, buildPath});
 
-      auto env = environment::build_env();
+      info.insert(info.end(), env.build_env().begin(), env.build_env().end());
+
+      return execute(Hooks::INSTALL, info, config.name());
+    }
 
-      info.insert(info.end(), env.begin(), env.end());
+    bool Plugin::is_interactive() const {
+      // frames would be mangled by a terminal
+      if (protocol_ >= protocol::FRAMED) {
+        return false;
+      }
 
-      return execute(Hooks::INSTALL, info);
+      // nobody to interact with if input is not a terminal
+      return interactive_ && isatty(STDIN_FILENO);
     }
 
-    Plugin::Result Plugin::execute(const Hooks &hook, const std::vector<std::string> &info) const {
-      int master = 0;
+    int Plugin::spawn(process::Child &child, bool worker, bool terminal, int request) const {
+      std::vector<char *> envp;
 
-      // fork a psuedo terminal
-      pid_t pid = forkpty(&master, nullptr, nullptr, nullptr);
+      for (char **env = environ; *env != nullptr; env++) {
+        envp.push_back(*env);
+      }
 
-      if (pid < 0) {
-        // respond to error
-        log::perror("forkpty");
-        return PREP_ERROR;
+      std::string workerEnv = std::string(internal::WORKER_ENV) + "=1";
+
+      // let the plugin know to keep reading requests
+      if (worker) {
+        envp.push_back(const_cast<char *>(workerEnv.c_str()));
       }
 
-      // if we're the child process...
-      if (pid == 0) {
-        // set the current directory to the plugin path
-        if (chdir(basePath_.c_str())) {
-          log::error("unable to change directory [", basePath_, "]");
-          return PREP_FAILURE;
-        }
+      std::string protocolEnv = std::string(protocol::VERSION_ENV) + "=" + std::to_string(protocol_);
+
+      // let the plugin know it can speak in frames
+      if (protocol_ >= protocol::FRAMED) {
+        envp.push_back(const_cast<char *>(protocolEnv.c_str()));
+      }
 
-        const char *argv[] = {name_.c_str(), nullptr};
+      std::string requestEnv = std::string(internal::REQUEST_ENV) + "=" + std::to_string(process::RequestFileno);
 
-        // execute the plugin in this process
-        execvp(executablePath_.c_str(), (char *const *)argv);
+      // let the plugin know where to find its request
+      if (request != -1) {
+        envp.push_back(const_cast<char *>(requestEnv.c_str()));
+      }
 
-        exit(PREP_FAILURE);  // exec never returns
-      } else {
-        // otherwise we are the parent process...
-        int status = 0;
-        internal::Interpreter interpreter(verbose_);
-        struct termios tios = {};
+      envp.push_back(nullptr);
 
-        // set some terminal flags to remove local echo
-        tcgetattr(master, &tios);
-        tios.c_lflag &= ~(ECHO | ECHONL | ECHOCTL);
-        tcsetattr(master, TCSAFLUSH, &tios);
+      const char *argv[] = {name_.c_str(), nullptr};
 
-        auto method = internal::to_string(hook);
+      if (!terminal) {
+        return process::spawn_pipes(executablePath_, (char *const *)argv, basePath_.c_str(), envp.data(), child,
+                                    request);
+      }
 
-        log::trace("executing [", method, "] on plugin [", name_, "]");
+      return process::spawn_terminal(executablePath_, (char *const *)argv, basePath_.c_str(), envp.data(), child,
+                                     request);
+    }
 
-        for (auto it = info.begin(); it != info.end(); ++it) {
-          log::trace("param: ", *it);
-        }
+    int Plugin::spawn_request(process::Child &child, bool terminal, const Hooks &hook,
+                              const std::vector<std::string> &info) const {
+      if (requestFile_) {
+        int request = internal::write_request_file(name_, hook, info, protocol_);
 
-        if (internal::write_header(master, method, info) == PREP_FAILURE) {
-          log::perror("write_header");
-          if (kill(pid, SIGKILL) < 0) {
-            log::perror("kill");
-          }
+        if (request < 0) {
           return PREP_ERROR;
         }
 
-        // start the io loop with child
-        while (!interpreter.failure()) {
-          fd_set read_fd = {};
-          std::string line;
+        // the plugin has its own copy of the descriptor
+        int rval = spawn(child, false, terminal, request);
 
-          FD_ZERO(&read_fd);
+        ::close(request);
 
-          FD_SET(master, &read_fd);
-          FD_SET(STDIN_FILENO, &read_fd);
+        return rval;
+      }
 
-          // wait for something to happen
-          if (select(master + 1, &read_fd, nullptr, nullptr, nullptr) < 0) {
-            if (errno == EINTR) {
-              continue;
-            }
-            log::perror("select");
-            break;
-          }
+      if (spawn(child, false, terminal) != PREP_SUCCESS) {
+        return PREP_ERROR;
+      }
 
-          // if we have something to read from child...
-          if (FD_ISSET(master, &read_fd)) {
-            // read a line
-            ssize_t n = io::read_line(master, line);
+      if (internal::send_request(name_, child.input, hook, info, protocol_) == PREP_ERROR) {
+        kill(child.pid, SIGKILL);
+        process::close(child);
+        waitpid(child.pid, nullptr, 0);
+        return PREP_ERROR;
+      }
 
-            if (n <= 0) {
-              if (n < 0 && errno != EIO) {
-                log::perror("read_line");
-              }
-              break;
-            }
+      return PREP_SUCCESS;
+    }
 
-            if (interpreter.interpret(line) == PREP_ERROR) {
-              log::perror("interpret");
-              break;
-            }
-          }
+    int Plugin::start_worker() const {
+      if (worker_.pid > 0) {
+        return PREP_SUCCESS;
+      }
 
-          // if we have something to read on stdin...
-          if (FD_ISSET(STDIN_FILENO, &read_fd)) {
-            ssize_t n = io::read_line(STDIN_FILENO, line);
+      if (spawn(worker_, true, is_interactive()) != PREP_SUCCESS) {
+        return PREP_ERROR;
+      }
 
-            interpreter.reset();
+      log::trace("started worker for plugin [", name_, "]");
 
-            if (n <= 0) {
-              if (n < 0) {
-                log::perror("read_line");
-              }
-              break;
-            }
+      return PREP_SUCCESS;
+    }
 
-            // send it to the child
-            if (io::write_line(master, line) < 0) {
-              log::perror("write_line");
-              break;
-            }
-          }
-        }
+    void Plugin::stop_worker() const {
+      if (worker_.pid <= 0) {
+        return;
+      }
 
-        // wait for the child to exit
-        pid = waitpid(pid, &status, WUNTRACED);
+      int status = 0;
 
-        if (pid == -1) {
-          log::perror("error waiting for plugin");
-          return PREP_FAILURE;
-        }
+      // closing the input hangs up the worker
+      process::close(worker_);
 
-        // check exit status of child
-        if (WIFEXITED(status)) {
-          // convert the exit status to a return value
-          int rval = WEXITSTATUS(status);
-          if (rval == 0 && interpreter.failure()) {
-            rval = process::NotAvailable;
-          }
-          // typically rval will be the return status of the command the plugin executes, 255 = -1
-          rval = rval == 255 ? PREP_ERROR : rval;
-          return {rval, interpreter.returns};
-        } else if (WIFSIGNALED(status)) {
-          int sig = WTERMSIG(status);
+      if (waitpid(worker_.pid, &status, WNOHANG) == 0) {
+        kill(worker_.pid, SIGTERM);
+        waitpid(worker_.pid, &status, 0);
+      }
 
-          // log signals
-          log::error(name(), " terminated signal ", sig);
+      log::trace("stopped worker for plugin [", name_, "]");
 
-          // and core dump
-          if (WCOREDUMP(status)) {
-            log::error(name(), " produced core dump");
-          }
-        } else if (WIFSTOPPED(status)) {
-          int sig = WSTOPSIG(status);
+      worker_.pid = -1;
+    }
 
-          log::error(name(), " stopped signal ", sig);
-        } else {
-          log::error(name(), " did not exit cleanly");
+    Plugin::Result Plugin::execute(const Hooks &hook, const std::vector<std::string> &info,
+                                   const std::string &package) const {
+      auto log = open_log(hook, package);
+
+      Result result(PREP_ERROR);
+
+      if (shared_) {
+        result = execute_shared(hook, info, log.get());
+      } else if (persistent_) {
+        result = execute_worker(hook, info, log.get());
+      } else {
+        result = execute_process(hook, info, log.get());
+      }
+
+      // the plugin may have made or removed anything while working on a package
+      if (hook != Hooks::LOAD && hook != Hooks::UNLOAD) {
+        filesystem::invalidate();
+      }
+
+      if (log == nullptr) {
+        return result;
+      }
+
+      // finish the log so it can be read back
+      log.reset();
+
+      if (result.code != PREP_SUCCESS && !verbose_ &&
+          (hook == Hooks::BUILD || hook == Hooks::TEST || hook == Hooks::INSTALL)) {
+        print_log_tail(hook, package);
+      }
+
+      return result;
+    }
+
+    std::unique_ptr<log::File> Plugin::open_log(const Hooks &hook, const std::string &package) const {
+      if (logPath_.empty() || package.empty() || hook == Hooks::LOAD || hook == Hooks::UNLOAD) {
+        return nullptr;
+      }
+
+      auto path = filesystem::build_path(logPath_, package, internal::to_string(hook) + LOG_EXTENSION);
+
+      struct stat st = {};
+
+      // another plugin has run this hook for the package already
+      bool append = stat(path.c_str(), &st) == 0 && st.st_mtime >= internal::START_TIME;
+
+      std::unique_ptr<log::File> file(new log::File(path, append));
+
+      if (!file->is_open()) {
+        log::debug("unable to open log ", path);
+        return nullptr;
+      }
+
+      file->write_line("==> " + name_ + " <==");
+
+      return file;
+    }
+
+    void Plugin::print_log_tail(const Hooks &hook, const std::string &package) const {
+      auto path = filesystem::build_path(logPath_, package, internal::to_string(hook) + LOG_EXTENSION);
+
+      auto lines = log::tail_file(path, internal::LOG_TAIL_LINES);
+
+      if (lines.empty()) {
+        return;
+      }
+
+      std::cerr << std::endl;
+
+      for (auto &line : lines) {
+        std::cerr << "  " << line << std::endl;
+      }
+
+      std::cerr << std::endl;
+
+      log::info("see ", color::m("prep logs " + package + " --hook " + internal::to_string(hook)),
+                " for the full output");
+    }
+
+    Plugin::Result Plugin::execute_process(const Hooks &hook, const std::vector<std::string> &info,
+                                           log::File *log) const {
+      process::Child child;
+
+      if (spawn_request(child, is_interactive(), hook, info) != PREP_SUCCESS) {
+        return PREP_ERROR;
+      }
+
+      // otherwise we are the parent process...
+      internal::Interpreter interpreter(verbose_, child.terminal, protocol_);
+
+      interpreter.set_log(log);
+
+      auto watchdog = internal::get_watchdog(config_, hook);
+
+      internal::communicate(name_, child, interpreter, watchdog, false);
+
+      auto result = internal::wait_for(name_, child.pid, interpreter, watchdog);
+
+      process::close(child);
+
+      return result;
+    }
+
+    Plugin::Result Plugin::execute_worker(const Hooks &hook, const std::vector<std::string> &info,
+                                          log::File *log) const {
+      // nothing to unload if the worker was never started
+      if (hook == Hooks::UNLOAD && worker_.pid <= 0) {
+        return PREP_SUCCESS;
+      }
+
+      if (start_worker() != PREP_SUCCESS) {
+        return PREP_ERROR;
+      }
+
+      internal::Interpreter interpreter(verbose_, worker_.terminal, protocol_, "", true);
+
+      interpreter.set_log(log);
+
+      if (internal::send_request(name_, worker_.input, hook, info, protocol_) == PREP_ERROR) {
+        stop_worker();
+        return PREP_ERROR;
+      }
+
+      auto watchdog = internal::get_watchdog(config_, hook);
+
+      internal::communicate(name_, worker_, interpreter, watchdog, true);
+
+      if (!interpreter.done()) {
+        // the worker exited without answering or was terminated, treat it like a regular plugin
+        auto result = internal::wait_for(name_, worker_.pid, interpreter, watchdog);
+
+        process::close(worker_);
+
+        worker_.pid = -1;
+        return result;
+      }
+
+      if (hook == Hooks::UNLOAD) {
+        stop_worker();
+      }
+
+      return internal::to_result(interpreter.code(), interpreter);
+    }
+
+    Plugin::Result Plugin::execute_shared(const Hooks &hook, const std::vector<std::string> &info,
+                                          log::File *log) const {
+      auto method = internal::to_string(hook);
+
+      auto function = reinterpret_cast<prep_plugin_hook>(
+          dlsym(library_.get(), (std::string(PREP_PLUGIN_HOOK_PREFIX) + method).c_str()));
+
+      // like an executable plugin that does not respond to the hook
+      if (function == nullptr) {
+        return PREP_FAILURE;
+      }
+
+      log::trace("executing [", method, "] on shared plugin [", name_, "]");
+
+      std::vector<const char *> params;
+
+      for (auto &value : info) {
+        log::trace("param: ", value);
+        params.push_back(value.c_str());
+      }
+
+      internal::Interpreter interpreter(verbose_, false, protocol::FRAMED);
+
+      interpreter.set_log(log);
+
+      prep_context context = {};
+
+      context.path = basePath_.c_str();
+      context.prep = &interpreter;
+      context.send = internal::send_message;
+
+      int rval = function(&context, params.data(), params.size());
+
+      interpreter.flush();
+
+      return internal::to_result(rval, interpreter);
+    }
+
+    std::shared_ptr<Plugin::Job> Plugin::start(const Hooks &hook, const std::vector<std::string> &info,
+                                               const std::string &package) const {
+      // shared plugins run in this process, so they are executed instead
+      if (shared_) {
+        return nullptr;
+      }
+
+      process::Child child;
+
+      // hooks running together have no terminal to share
+      if (spawn_request(child, false, hook, info) != PREP_SUCCESS) {
+        return nullptr;
+      }
+
+      // nothing more is sent, so the plugin sees the end of its input
+      ::close(child.input);
+      child.input = -1;
+
+      return std::shared_ptr<Job>(new Job(*this, child, hook, open_log(hook, package)));
+    }
+
+    Plugin::Job::Job(const Plugin &plugin, const process::Child &child, const Hooks &hook,
+                     std::unique_ptr<log::File> log)
+        : name_(plugin.name_),
+          child_(child),
+          log_(std::move(log)),
+          interpreter_(new internal::Interpreter(plugin.verbose_, false, plugin.protocol_, color::c(plugin.name_) + ": ")),
+          watchdog_(new internal::Watchdog(internal::get_watchdog(plugin.config_, hook))),
+          output_(child.output),
+          error_(child.error) {
+      interpreter_->set_log(log_.get());
+    }
+
+    Plugin::Job::~Job() { process::close(child_); }
+
+    const process::Child &Plugin::Job::child() const { return child_; }
+
+    bool Plugin::Job::read(int fd) {
+      auto &reader = fd == child_.error ? error_ : output_;
+
+      bool open = internal::interpret_lines(reader, *interpreter_, fd == child_.error ? STDERR_FILENO : STDOUT_FILENO,
+                                            false);
+
+      watchdog_->touch();
+
+      // after a failure the rest of the output is dropped so the plugin can finish
+      if (interpreter_->failure()) {
+        std::string line;
+
+        while (reader.next(line)) {
         }
       }
 
-      return PREP_FAILURE;
+      return open;
+    }
+
+    void Plugin::Job::flush() { interpreter_->flush(); }
+
+    long Plugin::Job::due() const { return interpreter_->due(); }
+
+    int Plugin::Job::progress() const { return interpreter_->progress(); }
+
+    long Plugin::Job::deadline() const { return watchdog_->due(); }
+
+    void Plugin::Job::enforce_deadline() { watchdog_->enforce(name_, child_.pid); }
+
+    Plugin::Result Plugin::Job::finish(int status) {
+      interpreter_->flush();
+
+      log_.reset();
+
+      process::close(child_);
+
+      filesystem::invalidate();
+
+      if (watchdog_->code() != PREP_SUCCESS) {
+        return watchdog_->code();
+      }
+
+      return internal::to_result(name_, status, *interpreter_);
     }
   }  // namespace prep
 }  // namespace micrantha
@@ -1,10 +1,13 @@
 #ifndef MICRANTHA_PREP_PLUGIN_H
 #define MICRANTHA_PREP_PLUGIN_H
 
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "util.h"
+
 namespace micrantha
 {
     namespace prep
@@ -12,6 +15,19 @@ namespace micrantha
         class Package;
         class PackageDependency;
 
+        namespace internal {
+            class Interpreter;
+            class Watchdog;
+        }
+
+        namespace log {
+            class File;
+        }
+
+        namespace environment {
+            class Snapshot;
+        }
+
         /**
          * represents a plugin
          */
@@ -31,6 +47,16 @@ namespace micrantha
              */
             constexpr static const char *const MANIFEST_FILE = "manifest.json";
 
+            /**
+             * the extension of the files hook output is logged to
+             */
+            constexpr static const char *const LOG_EXTENSION = ".log.gz";
+
+            /**
+             * @return the name of a hook, as sent to plugins
+             */
+            static std::string hook_name(const Hooks &hook);
+
             /**
              * a return value for executing a plugin.  has a code and a list of return values.
              * implicit constructors for flexible return values
@@ -38,6 +64,8 @@ namespace micrantha
             typedef struct Result {
                 int code;
                 std::vector<std::string> values;
+                // paths of anything the plugin reported producing
+                std::vector<std::string> artifacts;
 
                 Result(int c) : code(c) {
                 }
@@ -45,6 +73,10 @@ namespace micrantha
                 Result(int c, std::vector<std::string> r) : code(c), values(std::move(r)) {
                 }
 
+                Result(int c, std::vector<std::string> r, std::vector<std::string> a)
+                    : code(c), values(std::move(r)), artifacts(std::move(a)) {
+                }
+
                 bool operator==(int value) const {
                     return code == value;
                 }
@@ -54,6 +86,80 @@ namespace micrantha
                 }
             } Result;
 
+            /**
+             * a hook running on a plugin process that the caller does not wait on.
+             * the plugin runs on pipes with no input beyond the request, and its
+             * forwarded output is prefixed with the plugin name.
+             */
+            class Job {
+            public:
+                ~Job();
+
+                /* non-copyable */
+                Job(const Job &other) = delete;
+
+                Job &operator=(const Job &other) = delete;
+
+                /**
+                 * @return the plugin process
+                 */
+                const process::Child &child() const;
+
+                /**
+                 * interprets the output waiting on a descriptor of the plugin process
+                 * @param fd the output or error descriptor of the child
+                 * @return true if the descriptor is still open
+                 */
+                bool read(int fd);
+
+                /**
+                 * writes any output waiting to be forwarded
+                 */
+                void flush();
+
+                /**
+                 * @return the milliseconds until output must be flushed, or -1 if none is waiting
+                 */
+                long due() const;
+
+                /**
+                 * @return the last progress percentage the plugin reported, or -1
+                 */
+                int progress() const;
+
+                /**
+                 * @return the milliseconds until the time limits of the hook must be enforced, or -1 if never
+                 */
+                long deadline() const;
+
+                /**
+                 * terminates the plugin if the hook has run too long or gone too long without output,
+                 * escalating to a kill if it does not exit
+                 */
+                void enforce_deadline();
+
+                /**
+                 * completes the job once the plugin has exited
+                 * @param status the wait status of the plugin process
+                 * @return the result of the hook, TimedOut or Stalled if it was terminated
+                 */
+                Result finish(int status);
+
+            private:
+                friend class Plugin;
+
+                Job(const Plugin &plugin, const process::Child &child, const Hooks &hook,
+                    std::unique_ptr<log::File> log);
+
+                std::string name_;
+                process::Child child_;
+                std::unique_ptr<log::File> log_;
+                std::unique_ptr<internal::Interpreter> interpreter_;
+                std::unique_ptr<internal::Watchdog> watchdog_;
+                io::LineReader output_;
+                io::LineReader error_;
+            };
+
             /* constructors*/
             explicit Plugin(const std::string &name);
 
@@ -73,6 +179,11 @@ namespace micrantha
 
             bool is_enabled() const;
 
+            /**
+             * @return true if the plugin is a shared library running its hooks in this process
+             */
+            bool is_shared() const;
+
             // properties
             std::string name() const;
 
@@ -84,6 +195,11 @@ namespace micrantha
 
             Plugin &set_verbose(bool value);
 
+            /**
+             * sets where hook output is logged, each package having a folder of logs by hook
+             */
+            Plugin &set_log_path(const std::string &path);
+
             Plugin &set_enabled(bool value);
 
             Plugin &set_priority(int value);
@@ -102,11 +218,13 @@ namespace micrantha
             Result on_remove(const Package &config, const std::string &path) const;
 
             Result on_build(const Package &config, const std::string &sourcePath, const std::string &buildPath,
-                            const std::string &installPath) const;
+                            const std::string &installPath, const environment::Snapshot &env) const;
 
-            Result on_test(const Package &config, const std::string &sourcePath, const std::string &buildPath) const;
+            Result on_test(const Package &config, const std::string &sourcePath, const std::string &buildPath,
+                           const environment::Snapshot &env) const;
 
-            Result on_install(const Package &config, const std::string &sourcePath, const std::string &buildPath) const;
+            Result on_install(const Package &config, const std::string &sourcePath, const std::string &buildPath,
+                              const environment::Snapshot &env) const;
 
             /**
              * loads a plugin
@@ -116,6 +234,12 @@ namespace micrantha
             int load(const std::string &path);
 
             int save();
+
+            /**
+             * starts a resolve without waiting for it to finish
+             * @return the running hook, or nullptr if the plugin can not resolve or is shared
+             */
+            std::shared_ptr<Job> start_resolve(const Package &config, const std::string &sourcePath) const;
         private:
             friend class PluginManager;
 
@@ -123,11 +247,80 @@ namespace micrantha
              * executes this plugin.  this is where the magic happens
              * @param method the type of hook being executed
              * @param input the list of input arguments
+             * @param package the package the hook is for, whose logs keep the output
              * @return a result value.  The result code may contain PREP_SUCCESS if successful, PREP_ERROR if an
              * internal error occurred, or PREP_FAILURE if the plugin doesn't respond to the hook
              */
-            Result execute(const Hooks &method,
-                           const std::vector<std::string> &input = std::vector<std::string>()) const;
+            Result execute(const Hooks &method, const std::vector<std::string> &input = std::vector<std::string>(),
+                           const std::string &package = std::string()) const;
+
+            /**
+             * executes a hook on a new plugin process and waits for it
+             */
+            Result execute_process(const Hooks &method, const std::vector<std::string> &input, log::File *log) const;
+
+            /**
+             * executes a request on the persistent worker for this plugin, starting it if needed
+             */
+            Result execute_worker(const Hooks &method, const std::vector<std::string> &input, log::File *log) const;
+
+            /**
+             * executes a hook on a shared library plugin in this process
+             */
+            Result execute_shared(const Hooks &method, const std::vector<std::string> &input, log::File *log) const;
+
+            /**
+             * opens the log of a hook for a package.  logs from an earlier run are replaced, while
+             * plugins running the same hook in this run add to it.
+             * @return the log, or nullptr if the hook is not logged
+             */
+            std::unique_ptr<log::File> open_log(const Hooks &method, const std::string &package) const;
+
+            /**
+             * shows the end of a log after a hook failed
+             */
+            void print_log_tail(const Hooks &method, const std::string &package) const;
+
+            /**
+             * loads the library of a shared plugin
+             * @return PREP_SUCCESS or PREP_FAILURE if it is not a usable plugin library
+             */
+            int load_library();
+
+            /**
+             * starts a hook on a new plugin process without waiting for it
+             * @return the running hook, or nullptr if the plugin could not be started
+             */
+            std::shared_ptr<Job> start(const Hooks &method, const std::vector<std::string> &input,
+                                       const std::string &package) const;
+
+            /**
+             * starts the plugin executable on a pseudo terminal, or on pipes
+             * @param child set to the plugin process
+             * @param worker true if the plugin should stay alive for more requests
+             * @param terminal true if the plugin should run on a pseudo terminal
+             * @param request a file holding the request for the plugin, or -1 to write it to the plugin
+             * @return PREP_SUCCESS or PREP_ERROR if the plugin could not be started
+             */
+            int spawn(process::Child &child, bool worker, bool terminal, int request = -1) const;
+
+            /**
+             * starts the plugin for a single request
+             * @param child set to the plugin process
+             * @param terminal true if the plugin should run on a pseudo terminal
+             * @return PREP_SUCCESS or PREP_ERROR if the plugin could not be started or sent the request
+             */
+            int spawn_request(process::Child &child, bool terminal, const Hooks &method,
+                              const std::vector<std::string> &input) const;
+
+            /**
+             * @return true if the plugin should run on a pseudo terminal
+             */
+            bool is_interactive() const;
+
+            int start_worker() const;
+
+            void stop_worker() const;
 
             int read_config();
 
@@ -141,6 +334,20 @@ namespace micrantha
             bool enabled_;
             Types type_;
             bool verbose_;
+            bool persistent_;
+            bool interactive_;
+            // the protocol version the plugin speaks
+            int protocol_;
+            // the plugin reads its request from a file instead of its input
+            bool requestFile_;
+            // the plugin is a shared library loaded into this process
+            bool shared_;
+            std::string libraryPath_;
+            std::shared_ptr<void> library_;
+            // the folder of package logs
+            std::string logPath_;
+            // the running worker process, if persistent
+            mutable process::Child worker_;
         };
 
         std::ostream &operator<<(std::ostream &out, const Plugin::Result &result);
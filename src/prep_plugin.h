@@ -0,0 +1,61 @@
+#ifndef MICRANTHA_PREP_PLUGIN_ABI_H
+#define MICRANTHA_PREP_PLUGIN_ABI_H
+
+/*
+ * the interface for plugins loaded into prep as shared libraries, set with "kind": "shared" and
+ * "library": "<file>" in a plugin manifest.  a shared plugin runs its hooks in the prep process,
+ * so it must not exit, change the working directory or take over stdin and stdout.
+ *
+ * a library exports prep_plugin_abi() returning PREP_PLUGIN_ABI, and a function named
+ * prep_plugin_<hook> for each hook it handles (prep_plugin_resolve, prep_plugin_build, etc).
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the version of this interface */
+#define PREP_PLUGIN_ABI 1
+
+#define PREP_PLUGIN_ABI_SYMBOL "prep_plugin_abi"
+
+/* followed by the hook name, as sent to executable plugins */
+#define PREP_PLUGIN_HOOK_PREFIX "prep_plugin_"
+
+/* what a plugin can tell prep, as the frames of the plugin protocol */
+typedef enum prep_message {
+  PREP_MESSAGE_RETURN,
+  PREP_MESSAGE_LOG,
+  PREP_MESSAGE_OUTPUT,
+  PREP_MESSAGE_ERROR,
+  PREP_MESSAGE_PROGRESS,
+  PREP_MESSAGE_ARTIFACT
+} prep_message;
+
+/* handed to a hook for talking to prep, only valid during the call */
+typedef struct prep_context {
+  /* the folder of the plugin */
+  const char *path;
+
+  /* sends a message to prep, the payload is copied */
+  void (*send)(struct prep_context *context, prep_message type, const char *payload, size_t length);
+
+  /* belongs to prep */
+  void *prep;
+} prep_context;
+
+/*
+ * a hook, given the same parameters an executable plugin reads in its header.
+ * returns what an executable plugin would exit with.
+ */
+typedef int (*prep_plugin_hook)(prep_context *context, const char *const *params, size_t count);
+
+typedef int (*prep_plugin_abi_version)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+#include <strings.h>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "common.h"
+#include "protocol.h"
+
+namespace micrantha {
+  namespace prep {
+    namespace protocol {
+
+      namespace internal {
+        constexpr const char *const TYPE_NAMES[] = {"UNKNOWN", "HOOK", "PARAM", "END", "RETURN", "LOG",
+                                                    "OUTPUT", "ERROR", "PROGRESS", "ARTIFACT", "DONE"};
+
+        typedef struct Entry {
+          std::string_view name;
+          Command command;
+        } Entry;
+
+        // the line commands, no name is a prefix of another so the first match is the only one
+        constexpr Entry COMMANDS[] = {{"RETURN", Command::RETURN},
+                                      {"DONE", Command::DONE},
+                                      {"ECHO", Command::LOG},
+                                      {"ERROR", Command::ERROR},
+                                      {"EMIT", Command::EMIT}};
+      }
+
+      const char *to_string(Type type) { return internal::TYPE_NAMES[static_cast<int>(type)]; }
+
+      Type to_type(std::string_view name) {
+        for (size_t i = 1; i < sizeof(internal::TYPE_NAMES) / sizeof(internal::TYPE_NAMES[0]); i++) {
+          if (name == internal::TYPE_NAMES[i]) {
+            return static_cast<Type>(i);
+          }
+        }
+        return Type::UNKNOWN;
+      }
+
+      Command classify(std::string_view line, std::string_view &args) {
+        if (line.empty()) {
+          return Command::NONE;
+        }
+
+        // most output is plain, so most lines are done with after one character
+        auto first = std::toupper(static_cast<unsigned char>(line.front()));
+
+        for (auto &entry : internal::COMMANDS) {
+          auto length = entry.name.length();
+
+          if (entry.name.front() != first || line.length() < length ||
+              strncasecmp(line.data(), entry.name.data(), length) != 0) {
+            continue;
+          }
+
+          args = line.length() > length + 1 ? line.substr(length + 1) : std::string_view();
+
+          return entry.command;
+        }
+
+        return Command::NONE;
+      }
+
+      ssize_t write_frame(io::LineWriter &writer, Type type, const std::string &payload) {
+        std::string header(to_string(type));
+
+        header += ' ';
+        header += std::to_string(payload.length());
+
+        if (writer.write_line(header) < 0 || writer.write_line(payload) < 0) {
+          return -1;
+        }
+
+        return header.length() + payload.length() + 2;
+      }
+
+      int write_request(int fd, const std::string &method, const std::vector<std::string> &info) {
+        // the whole request goes out in one write
+        io::LineWriter writer(fd, std::numeric_limits<size_t>::max());
+
+        write_frame(writer, Type::HOOK, method);
+
+        for (auto &value : info) {
+          write_frame(writer, Type::PARAM, value);
+        }
+
+        write_frame(writer, Type::END, "");
+
+        if (writer.flush() < 0) {
+          return PREP_FAILURE;
+        }
+
+        return PREP_SUCCESS;
+      }
+
+      Parser::Parser() : header_(false), type_(Type::UNKNOWN), length_(0) {}
+
+      int Parser::next(io::LineReader &reader, Frame &frame) {
+        if (!header_) {
+          std::string line;
+
+          if (!reader.next(line)) {
+            return PREP_FAILURE;
+          }
+
+          std::string_view header(line);
+
+          auto space = header.find(' ');
+
+          if (space == std::string::npos) {
+            return PREP_ERROR;
+          }
+
+          char *end = nullptr;
+
+          auto length = strtoull(line.c_str() + space + 1, &end, 10);
+
+          if (end == line.c_str() + space + 1 || *end != '\0' || length > MAX_PAYLOAD) {
+            return PREP_ERROR;
+          }
+
+          // unknown types are passed on so newer plugins still work
+          type_ = to_type(header.substr(0, space));
+          length_ = length;
+          header_ = true;
+        }
+
+        // the payload and its trailing newline
+        if (!reader.next(length_ + 1, frame.payload)) {
+          return reader.eof() ? PREP_ERROR : PREP_FAILURE;
+        }
+
+        header_ = false;
+
+        if (frame.payload.back() != '\n') {
+          return PREP_ERROR;
+        }
+
+        frame.payload.pop_back();
+        frame.type = type_;
+
+        return PREP_SUCCESS;
+      }
+    }
+  }
+}
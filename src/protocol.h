@@ -0,0 +1,112 @@
+#ifndef MICRANTHA_PREP_PROTOCOL_H
+#define MICRANTHA_PREP_PROTOCOL_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util.h"
+
+namespace micrantha {
+  namespace prep {
+
+    /**
+     * the framed plugin protocol (version 2).  every message is a frame made of a header line with
+     * a type and payload length, followed by the payload and a newline:
+     *
+     *     RETURN 11\n/tmp/source\n
+     *
+     * payloads may contain anything, including newlines.  a plugin opts in with "protocol": 2 in
+     * its manifest and is told with PREP_PROTOCOL=2 in its environment.
+     */
+    namespace protocol {
+
+      // the first version using frames
+      constexpr static const int FRAMED = 2;
+
+      // set in the environment of a plugin to the protocol version in use
+      constexpr const char *const VERSION_ENV = "PREP_PROTOCOL";
+
+      // the largest payload accepted, anything bigger is treated as garbage
+      constexpr static const size_t MAX_PAYLOAD = 64 * 1024 * 1024;
+
+      enum class Type : int {
+        UNKNOWN,
+        // sent to a plugin
+        HOOK, PARAM, END,
+        // sent by a plugin
+        RETURN, LOG, OUTPUT, ERROR, PROGRESS, ARTIFACT, DONE
+      };
+
+      /**
+       * the commands of the line protocol (version 1), a command is a line starting with its name.
+       * ECHO is known as LOG, as it is in frames, since termios defines ECHO.
+       */
+      enum class Command : int { NONE, RETURN, DONE, LOG, ERROR, EMIT };
+
+      /**
+       * a message in the protocol
+       */
+      typedef struct Frame {
+        Type type = Type::UNKNOWN;
+        std::string payload;
+      } Frame;
+
+      /**
+       * @return the name of a frame type as it appears in a header
+       */
+      const char *to_string(Type type);
+
+      /**
+       * @return the frame type for a header name, or UNKNOWN
+       */
+      Type to_type(std::string_view name);
+
+      /**
+       * classifies a line of output from a plugin speaking the line protocol.  names are matched
+       * without case and the arguments start after the character following the name.
+       * @param line the line of output
+       * @param args set to the arguments of a command, a view into the line
+       * @return the command or NONE for plain output
+       */
+      Command classify(std::string_view line, std::string_view &args);
+
+      /**
+       * queues a frame on a writer
+       * @return the number of bytes queued or -1 on error
+       */
+      ssize_t write_frame(io::LineWriter &writer, Type type, const std::string &payload);
+
+      /**
+       * writes a request to a plugin as a HOOK frame, a PARAM frame per argument and an END frame
+       * @return PREP_SUCCESS or PREP_FAILURE on error
+       */
+      int write_request(int fd, const std::string &method, const std::vector<std::string> &info);
+
+      /**
+       * parses frames out of buffered input, a frame may arrive over several reads
+       */
+      class Parser {
+       public:
+        Parser();
+
+        /**
+         * takes the next complete frame from a reader
+         * @param reader the buffered input
+         * @param frame set to the frame
+         * @return PREP_SUCCESS if a frame was set, PREP_FAILURE if more input is needed,
+         * or PREP_ERROR if the input is not a frame
+         */
+        int next(io::LineReader &reader, Frame &frame);
+
+       private:
+        // a header has been read and the payload is awaited
+        bool header_;
+        Type type_;
+        size_t length_;
+      };
+    }
+  }
+}
+
+#endif
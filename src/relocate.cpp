@@ -0,0 +1,290 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include "common.h"
+#include "relocate.h"
+#include "util.h"
+#include "walk.h"
+
+namespace micrantha {
+  namespace prep {
+    namespace relocate {
+
+      namespace internal {
+        // written next to a text file being replaced
+        constexpr static const char *const TEMP_SUFFIX = ".prep-relocate";
+
+        /**
+         * tests if a character ends the prefix of a path, so /x/.prep is not found in /x/.prep2
+         */
+        bool is_boundary(char c) {
+          return c == '/' || c == ':' || c == '\0' || c == '"' || c == '\'' || c == ';' || isspace(static_cast<unsigned char>(c));
+        }
+
+        /**
+         * finds a prefix in a block of memory.  memmem compares many bytes at a time, which matters as
+         * most of what is searched does not have the prefix.
+         * @return the start of the prefix, or nullptr if not found
+         */
+        const char *find(const char *data, size_t size, const std::string &prefix) {
+          const char *end = data + size;
+
+          for (auto pos = static_cast<const char *>(memmem(data, size, prefix.data(), prefix.length()));
+               pos != nullptr; pos = static_cast<const char *>(memmem(pos + 1, end - pos - 1, prefix.data(),
+                                                                      prefix.length()))) {
+            auto next = pos + prefix.length();
+
+            if (next == end || is_boundary(*next)) {
+              return pos;
+            }
+          }
+
+          return nullptr;
+        }
+
+        /**
+         * writes text with the prefix replaced next to the file, then moves it over the file
+         */
+        int rewrite_text(const std::string &path, const struct stat &st, const char *data, size_t size,
+                         const std::string &from, const std::string &to) {
+          std::string text;
+          const char *end = data + size;
+
+          text.reserve(size + to.length());
+
+          for (const char *pos = find(data, size, from); pos != nullptr; pos = find(data, end - data, from)) {
+            text.append(data, pos - data).append(to);
+            data = pos + from.length();
+          }
+
+          text.append(data, end - data);
+
+          auto temp = path + TEMP_SUFFIX;
+
+          int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+
+          if (fd == -1) {
+            return PREP_ERROR;
+          }
+
+          if (io::write(fd, text) < 0 || fchmod(fd, st.st_mode & 07777) == -1) {
+            close(fd);
+            unlink(temp.c_str());
+            return PREP_ERROR;
+          }
+
+          close(fd);
+
+          if (rename(temp.c_str(), path.c_str()) == -1) {
+            unlink(temp.c_str());
+            return PREP_ERROR;
+          }
+
+          return PREP_SUCCESS;
+        }
+
+        /**
+         * replaces the prefix in the strings of a binary file, keeping every string where it is
+         */
+        int rewrite_binary(const std::string &path, const struct stat &st, size_t size, const std::string &from,
+                           const std::string &to) {
+          if (to.length() > from.length()) {
+            return PREP_FAILURE;
+          }
+
+          // installed files are often read only
+          bool restore = (st.st_mode & S_IWUSR) == 0;
+
+          if (restore && chmod(path.c_str(), st.st_mode | S_IWUSR) == -1) {
+            return PREP_ERROR;
+          }
+
+          int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+          void *map = fd == -1 ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+          if (fd != -1) {
+            close(fd);
+          }
+
+          int rval = PREP_ERROR;
+
+          if (map != MAP_FAILED) {
+            auto data = static_cast<char *>(map);
+            auto end = data + size;
+
+            for (auto pos = const_cast<char *>(find(data, size, from)); pos != nullptr;
+                 pos = const_cast<char *>(find(pos, end - pos, from))) {
+              // the rest of the string moves up behind the new prefix
+              auto tail = pos + from.length();
+              auto terminator = static_cast<char *>(memchr(tail, 0, end - tail));
+
+              if (terminator == nullptr) {
+                terminator = end;
+              }
+
+              memcpy(pos, to.data(), to.length());
+              memmove(pos + to.length(), tail, terminator - tail);
+              memset(terminator - (from.length() - to.length()), 0, from.length() - to.length());
+
+              pos += to.length();
+            }
+
+            rval = msync(map, size, MS_SYNC) == -1 ? PREP_ERROR : PREP_SUCCESS;
+
+            munmap(map, size);
+          }
+
+          if (restore) {
+            int error = errno;
+            chmod(path.c_str(), st.st_mode);
+            errno = error;
+          }
+
+          return rval;
+        }
+
+        /**
+         * points a symbolic link at the new prefix, if it pointed under the old one
+         */
+        int rewrite_link(const std::string &path, const std::string &from, const std::string &to) {
+          char buf[PATH_MAX + 1] = {0};
+
+          ssize_t n = readlink(path.c_str(), buf, PATH_MAX);
+
+          if (n == -1) {
+            return PREP_ERROR;
+          }
+
+          std::string target(buf, n);
+
+          if (target.compare(0, from.length(), from) != 0 ||
+              (target.length() > from.length() && !is_boundary(target[from.length()]))) {
+            return PREP_FAILURE;
+          }
+
+          target.replace(0, from.length(), to);
+
+          if (unlink(path.c_str()) == -1 || symlink(target.c_str(), path.c_str()) == -1) {
+            return PREP_ERROR;
+          }
+
+          return PREP_SUCCESS;
+        }
+
+        /**
+         * replaces a prefix in a file
+         * @param found set to true if the file has the prefix
+         */
+        int rewrite_file(const std::string &path, const std::string &from, const std::string &to, bool &found) {
+          found = false;
+
+          if (from.empty() || from == to) {
+            return PREP_FAILURE;
+          }
+
+          int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+          if (fd == -1) {
+            return PREP_ERROR;
+          }
+
+          struct stat st = {};
+
+          if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            return PREP_ERROR;
+          }
+
+          auto size = static_cast<size_t>(st.st_size);
+
+          if (size < from.length()) {
+            close(fd);
+            return PREP_FAILURE;
+          }
+
+          void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+          close(fd);
+
+          if (map == MAP_FAILED) {
+            return PREP_ERROR;
+          }
+
+          auto data = static_cast<const char *>(map);
+          int rval = PREP_FAILURE;
+
+          if (find(data, size, from) != nullptr) {
+            found = true;
+
+            // text has no NUL bytes in it
+            if (memchr(data, 0, size) == nullptr) {
+              rval = rewrite_text(path, st, data, size, from, to);
+            } else {
+              rval = rewrite_binary(path, st, size, from, to);
+            }
+          }
+
+          munmap(map, size);
+
+          return rval;
+        }
+      }  // namespace internal
+
+      int rewrite_file(const std::string &path, const std::string &from, const std::string &to) {
+        bool found;
+
+        return internal::rewrite_file(path, from, to, found);
+      }
+
+      int rewrite_tree(const std::string &path, const std::string &from, const std::string &to, Stats &stats) {
+        stats = {};
+
+        int rval = PREP_SUCCESS;
+
+        walk::Options options;
+
+        options.file = [&path, &from, &to, &stats, &rval](const walk::Entry &entry) {
+          auto file = entry.depth == 0 ? path : filesystem::build_path(path, entry.path());
+          bool found = false;
+          int result;
+
+          switch (entry.type) {
+            case DT_REG:
+              result = internal::rewrite_file(file, from, to, found);
+              break;
+            case DT_LNK:
+              result = internal::rewrite_link(file, from, to);
+              break;
+            default:
+              return walk::NEXT;
+          }
+
+          if (result == PREP_SUCCESS) {
+            stats.files++;
+          } else if (result == PREP_ERROR) {
+            rval = PREP_ERROR;
+          } else if (found) {
+            stats.skipped++;
+          }
+
+          return walk::NEXT;
+        };
+
+        // a folder that can not be read has files that were not changed
+        if (walk::tree(path, options) == PREP_ERROR) {
+          return PREP_ERROR;
+        }
+
+        return rval;
+      }
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef MICRANTHA_PREP_RELOCATE_H
+#define MICRANTHA_PREP_RELOCATE_H
+
+#include <string>
+
+namespace micrantha {
+  namespace prep {
+    namespace relocate {
+
+      /**
+       * a count of what a relocation changed
+       */
+      typedef struct {
+        // files with the prefix replaced
+        size_t files;
+        // binary files the new prefix did not fit in
+        size_t skipped;
+      } Stats;
+
+      /**
+       * replaces a prefix in a file.  text files are rewritten with the new prefix.  binary files keep
+       * their size, each string holding the prefix is shortened and padded with NUL bytes, so the new
+       * prefix may not be longer than the old one.  the prefix is only replaced where a separator or the
+       * end of a string follows it.
+       * @param path the file to change
+       * @param from the prefix to replace
+       * @param to the prefix to replace it with
+       * @return PREP_SUCCESS if changed, PREP_FAILURE if the file has no prefix or it could not be replaced,
+       * PREP_ERROR if the file could not be changed
+       */
+      int rewrite_file(const std::string &path, const std::string &from, const std::string &to);
+
+      /**
+       * replaces a prefix in every file under a folder, and in symbolic links pointing into it
+       * @param path the folder
+       * @param from the prefix to replace
+       * @param to the prefix to replace it with
+       * @param stats set to what was changed
+       * @return PREP_SUCCESS, or PREP_ERROR if a file could not be changed
+       */
+      int rewrite_tree(const std::string &path, const std::string &from, const std::string &to, Stats &stats);
+    }
+  }
+}
+
+#endif
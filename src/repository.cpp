@@ -1,28 +1,240 @@
 
 #include <dirent.h>
-#include <fts.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cctype>
 #include <cerrno>
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <set>
+#include <sstream>
+#include <vector>
 #include <dlfcn.h>
 
+#include "batch.h"
 #include "common.h"
 #include "decompressor.h"
+#include "environment.h"
 #include "log.h"
+#include "relocate.h"
 #include "repository.h"
+#include "scheduler.h"
 #include "util.h"
+#include "walk.h"
 #include "plugins_archive.h"
 
 namespace micrantha
 {
     namespace prep
     {
+        namespace internal
+        {
+            bool can_resolve(const std::shared_ptr<Plugin> &plugin)
+            {
+                return plugin->is_enabled() && plugin->type() == Plugin::Types::RESOLVER;
+            }
+
+            // the key for a resolved location, changes with the plugin version
+            std::string resolve_key(const std::shared_ptr<Plugin> &plugin, const std::string &location)
+            {
+                std::ostringstream buf;
+
+                buf << plugin->name() << '\n' << plugin->version() << '\n' << location;
+
+                return buf.str();
+            }
+
+            // the key for a resolved package, changes with the plugin or the package settings
+            std::string resolve_key(const std::shared_ptr<Plugin> &plugin, const Package &config)
+            {
+                std::ostringstream buf;
+
+                buf << plugin->name() << '\n' << plugin->version() << '\n' << config.name() << '\n'
+                    << config.version() << '\n' << config.location() << '\n'
+                    << config.get_value(plugin->name()).dump();
+
+                return buf.str();
+            }
+
+            constexpr const char *const LINK_MODES[] = {"symlink", "hardlink", "reflink", "copy"};
+
+            std::string to_string(Repository::LinkMode mode)
+            {
+                return LINK_MODES[static_cast<int>(mode)];
+            }
+
+            // @return true if a mode was found by name
+            bool to_link_mode(const std::string &name, Repository::LinkMode &mode)
+            {
+                for (size_t i = 0; i < sizeof(LINK_MODES) / sizeof(LINK_MODES[0]); i++) {
+                    if (strcasecmp(LINK_MODES[i], name.c_str()) == 0) {
+                        mode = static_cast<Repository::LinkMode>(i);
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // the package an install folder belongs to
+            std::string package_name(const std::string &installPath)
+            {
+                auto pos = installPath.find_last_of('/');
+
+                return pos == std::string::npos ? installPath : installPath.substr(pos + 1);
+            }
+
+            constexpr const char *const SIZE_UNITS = "KMGT";
+
+            // the seconds in a day, budget ages are set in days
+            constexpr const time_t DAY = 24 * 60 * 60;
+
+            /**
+             * reads a size from the repository settings, a number of bytes or a string such as "10G"
+             * @return true if the value is a size
+             */
+            bool to_bytes(const Package::json_type &value, uint64_t &bytes)
+            {
+                if (value.is_number()) {
+                    if (value.get<double>() < 0) {
+                        return false;
+                    }
+                    bytes = static_cast<uint64_t>(value.get<double>());
+                    return true;
+                }
+
+                if (!value.is_string()) {
+                    return false;
+                }
+
+                auto text = value.get<std::string>();
+
+                char *end = nullptr;
+
+                auto number = strtod(text.c_str(), &end);
+
+                if (end == text.c_str() || number < 0) {
+                    return false;
+                }
+
+                double scale = 1;
+
+                if (*end != '\0') {
+                    auto unit = strchr(SIZE_UNITS, toupper(*end));
+
+                    if (unit == nullptr) {
+                        return false;
+                    }
+
+                    for (auto i = SIZE_UNITS; i <= unit; i++) {
+                        scale *= 1024;
+                    }
+
+                    end++;
+
+                    // "10G" or "10GB"
+                    if (toupper(*end) == 'B') {
+                        end++;
+                    }
+
+                    if (*end != '\0') {
+                        return false;
+                    }
+                }
+
+                bytes = static_cast<uint64_t>(number * scale);
+
+                return true;
+            }
+
+            // sets when a folder was last used to now
+            void touch(const std::string &path)
+            {
+                if (utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == -1 && errno != ENOENT) {
+                    log::debug("unable to mark ", path, " used: ", strerror(errno));
+                }
+            }
+
+            // a file of a package and where it goes in the repository
+            typedef struct {
+                std::string from;
+                std::string to;
+                // the path in both the package and the repository
+                std::string relative;
+                // the file in the package
+                struct stat st;
+                // what is already in the repository, if found
+                struct stat existing;
+                bool found;
+            } Linked;
+
+            /**
+             * reads the files a package copied into the repository
+             * @return the paths relative to the repository
+             */
+            std::set<std::string> read_copies(const std::string &metaDir)
+            {
+                std::ifstream in(filesystem::build_path(metaDir, Repository::COPIES_FILE));
+
+                std::set<std::string> copies;
+
+                std::string line;
+
+                while (std::getline(in, line)) {
+                    if (!line.empty()) {
+                        copies.insert(line);
+                    }
+                }
+
+                return copies;
+            }
+
+            // keeps the files a package copied into the repository, removing the list when there are none
+            int write_copies(const std::string &metaDir, const std::set<std::string> &copies)
+            {
+                auto path = filesystem::build_path(metaDir, Repository::COPIES_FILE);
+
+                if (copies.empty()) {
+                    return unlink(path.c_str()) == 0 || errno == ENOENT ? PREP_SUCCESS : PREP_FAILURE;
+                }
+
+                std::ofstream out(path);
+
+                for (const auto &copy : copies) {
+                    out << copy << '\n';
+                }
+
+                return out.good() ? PREP_SUCCESS : PREP_FAILURE;
+            }
+
+            /**
+             * tests if what is in the repository was put there for a file of a package, whatever the link mode was
+             * @param copies the files the package copied into the repository
+             */
+            bool is_linked(const Linked &file, const std::set<std::string> &copies)
+            {
+                if (S_ISLNK(file.existing.st_mode)) {
+                    return true;
+                }
+
+                if (!S_ISREG(file.existing.st_mode)) {
+                    return false;
+                }
+
+                // a hard link to the file of the package
+                if (file.existing.st_dev == file.st.st_dev && file.existing.st_ino == file.st.st_ino) {
+                    return true;
+                }
+
+                // anyone else's file is never on the list
+                return copies.count(file.relative) > 0;
+            }
+        }
 
         std::string const Repository::get_local_repo()
         {
@@ -49,9 +261,39 @@ namespace micrantha
               return PREP_FAILURE;
             }
 
+            // finish removing anything an earlier run left behind
+            if (filesystem::empty_trash(filesystem::build_path(path_, KITCHEN_FOLDER, TRASH_FOLDER)) != PREP_SUCCESS) {
+              log::debug("unable to empty the trash");
+            }
+
+            if (read_config() != PREP_SUCCESS) {
+              return PREP_FAILURE;
+            }
+
+            // the repository may not have existed before
+            environment::invalidate();
+
             return initialize_plugins(opts);
         }
 
+        int Repository::remove_trash(const std::string &path)
+        {
+            char buf[PATH_MAX] = {0};
+
+            auto suffix = filesystem::build_path("", KITCHEN_FOLDER, TRASH_FOLDER);
+
+            // only ever a trash folder, whatever the environment says
+            if (realpath(path.c_str(), buf) == nullptr || strlen(buf) <= suffix.length() ||
+                strcmp(buf + strlen(buf) - suffix.length(), suffix.c_str()) != 0) {
+                log::error(path, " is not a trash folder");
+                return PREP_FAILURE;
+            }
+
+            filesystem::close_inherited();
+
+            return filesystem::remove_trash(buf);
+        }
+
         int Repository::initialize_plugins(const Options &opts) {
             std::string path = get_plugin_path();
 
@@ -80,6 +322,7 @@ namespace micrantha
                 switch (plugin->load(pluginPath)) {
                     case PREP_SUCCESS:
                         plugin->set_verbose(opts.verbose == Verbosity::All);
+                        plugin->set_log_path(filesystem::build_path(path_, KITCHEN_FOLDER, LOGS_FOLDER));
                         plugins_.push_back(plugin);
                         if (plugin->type() != Plugin::Types::INTERNAL) {
                             log::trace("found plugin ", color::m(plugin->name()), " version [",
@@ -112,12 +355,201 @@ namespace micrantha
             return PREP_SUCCESS;
         }
 
+        int Repository::read_config() {
+            std::ifstream in(filesystem::build_path(path_, CONFIG_FILE));
+
+            if (!in.is_open()) {
+                return PREP_SUCCESS;
+            }
+
+            std::ostringstream buf;
+
+            in >> buf.rdbuf();
+
+            auto config = Package::json_type::parse(buf.str().c_str());
+
+            if (!config.is_object()) {
+                log::error("invalid repository settings in ", filesystem::build_path(path_, CONFIG_FILE));
+                return PREP_FAILURE;
+            }
+
+            auto value = config.find("link_mode");
+
+            if (value != config.end()) {
+                if (!value->is_string() || !internal::to_link_mode(value->get<std::string>(), linkMode_)) {
+                    log::error("unknown link mode ", value->dump(), ", use symlink, hardlink, reflink or copy");
+                    return PREP_FAILURE;
+                }
+            }
+
+            log::trace("linking packages with ", internal::to_string(linkMode_));
+
+            value = config.find("gc");
+
+            if (value == config.end()) {
+                return PREP_SUCCESS;
+            }
+
+            if (!value->is_object()) {
+                log::error("invalid gc settings ", value->dump(), ", use an object of max_size, max_age and min_free");
+                return PREP_FAILURE;
+            }
+
+            auto setting = value->find("max_size");
+
+            if (setting != value->end() && !internal::to_bytes(*setting, budget_.max_size)) {
+                log::error("invalid gc max_size ", setting->dump(), ", use bytes or a size such as \"10G\"");
+                return PREP_FAILURE;
+            }
+
+            setting = value->find("min_free");
+
+            if (setting != value->end() && !internal::to_bytes(*setting, budget_.min_free)) {
+                log::error("invalid gc min_free ", setting->dump(), ", use bytes or a size such as \"10G\"");
+                return PREP_FAILURE;
+            }
+
+            setting = value->find("max_age");
+
+            if (setting != value->end()) {
+                if (!setting->is_number() || setting->get<double>() < 0) {
+                    log::error("invalid gc max_age ", setting->dump(), ", use a number of days");
+                    return PREP_FAILURE;
+                }
+                budget_.max_age = static_cast<time_t>(setting->get<double>() * internal::DAY);
+            }
+
+            return PREP_SUCCESS;
+        }
+
+        const Repository::Budget &Repository::budget() const
+        {
+            return budget_;
+        }
+
+        void Repository::mark_used(const std::string &package_name) const
+        {
+            internal::touch(get_source_path(package_name));
+            internal::touch(get_build_path(package_name));
+            internal::touch(get_install_path(package_name));
+        }
+
+        int Repository::mark_unlinked(const std::string &package_name) const
+        {
+            std::ofstream out(filesystem::build_path(get_meta_path(package_name), UNLINKED_FILE));
+
+            return out.is_open() ? PREP_SUCCESS : PREP_FAILURE;
+        }
+
+        bool Repository::is_unlinked(const std::string &package_name) const
+        {
+            return filesystem::file_exists(filesystem::build_path(get_meta_path(package_name), UNLINKED_FILE)) ==
+                   PREP_SUCCESS;
+        }
+
+        int Repository::mark_runpaths(const std::string &package_name, bool complete) const
+        {
+            auto path = filesystem::build_path(get_meta_path(package_name), RUNPATH_FILE);
+
+            if (!complete) {
+                return unlink(path.c_str()) == 0 || errno == ENOENT ? PREP_SUCCESS : PREP_FAILURE;
+            }
+
+            std::ofstream out(path);
+
+            return out.is_open() ? PREP_SUCCESS : PREP_FAILURE;
+        }
+
+        bool Repository::has_runpaths(const std::string &package_name) const
+        {
+            return filesystem::file_exists(filesystem::build_path(get_meta_path(package_name), RUNPATH_FILE)) ==
+                   PREP_SUCCESS;
+        }
+
+        std::vector<Repository::Folder> Repository::package_folders() const
+        {
+            std::vector<Folder> folders;
+
+            for (auto kind : {SOURCE_FOLDER, BUILD_FOLDER, INSTALL_FOLDER}) {
+                auto path = filesystem::build_path(path_, KITCHEN_FOLDER, kind);
+
+                DIR *dir = opendir(path.c_str());
+
+                if (dir == nullptr) {
+                    continue;
+                }
+
+                struct dirent *d = nullptr;
+
+                while ((d = readdir(dir)) != nullptr) {
+                    if (d->d_name[0] == '.') {
+                        continue;
+                    }
+
+                    Folder folder{d->d_name, filesystem::build_path(path, d->d_name), kind, 0, 0};
+
+                    struct stat st = {};
+
+                    // resolve records and anything else that is not a package
+                    if (lstat(folder.path.c_str(), &st) == -1 || !S_ISDIR(st.st_mode)) {
+                        continue;
+                    }
+
+                    folder.used = st.st_mtime;
+
+                    if (filesystem::disk_usage(folder.path, folder.size) != PREP_SUCCESS) {
+                        log::debug("unable to size all of ", folder.path);
+                    }
+
+                    folders.push_back(folder);
+                }
+
+                closedir(dir);
+            }
+
+            return folders;
+        }
+
+        Repository::LinkMode Repository::link_mode() const
+        {
+            return linkMode_;
+        }
+
+        int Repository::link_file(const char *from, const char *to) const
+        {
+            switch (linkMode_) {
+                case LinkMode::SYMLINK:
+                    return symlink(from, to) ? PREP_FAILURE : PREP_SUCCESS;
+                case LinkMode::HARDLINK:
+                    if (link(from, to) == 0) {
+                        return PREP_SUCCESS;
+                    }
+                    // another file system, or not allowed
+                    if (errno != EXDEV && errno != EPERM && errno != EMLINK) {
+                        return PREP_FAILURE;
+                    }
+                    log::debug("unable to hard link [", strerror(errno), "], copying ", to);
+                    break;
+                case LinkMode::REFLINK:
+                    if (filesystem::clone_file(from, to) == PREP_SUCCESS) {
+                        return PREP_SUCCESS;
+                    }
+                    log::debug("unable to clone [", strerror(errno), "], copying ", to);
+                    break;
+                case LinkMode::COPY:
+                    break;
+            }
+
+            return filesystem::copy_file(from, to);
+        }
+
         int Repository::initialize_kitchen() const {
           auto dirs = {
             filesystem::build_path(path_, KITCHEN_FOLDER, SOURCE_FOLDER),
             filesystem::build_path(path_, KITCHEN_FOLDER, INSTALL_FOLDER),
             filesystem::build_path(path_, KITCHEN_FOLDER, BUILD_FOLDER),
-            filesystem::build_path(path_, KITCHEN_FOLDER, BIN_FOLDER)
+            filesystem::build_path(path_, KITCHEN_FOLDER, BIN_FOLDER),
+            filesystem::build_path(path_, KITCHEN_FOLDER, TRASH_FOLDER)
           };
 
           for (auto dir : dirs) {
@@ -259,11 +691,21 @@ namespace micrantha
             return filesystem::build_path(path_, BIN_FOLDER);
         }
 
+        std::string Repository::get_lib_path() const
+        {
+            return filesystem::build_path(path_, LIB_FOLDER);
+        }
+
         std::string Repository::get_plugin_path() const
         {
             return filesystem::build_path(path_, PLUGIN_FOLDER);
         }
 
+        std::string Repository::get_kitchen_path() const
+        {
+            return filesystem::build_path(path_, KITCHEN_FOLDER);
+        }
+
         std::string Repository::get_build_path(const std::string &package_name) const
         {
             return filesystem::build_path(path_, KITCHEN_FOLDER, BUILD_FOLDER, package_name);
@@ -284,6 +726,28 @@ namespace micrantha
             return filesystem::build_path(path_, KITCHEN_FOLDER, META_FOLDER, package_name);
         }
 
+        std::string Repository::get_log_path(const std::string &package_name) const
+        {
+            return filesystem::build_path(path_, KITCHEN_FOLDER, LOGS_FOLDER, package_name);
+        }
+
+        int Repository::discard(const std::string &path) const
+        {
+            auto trash = filesystem::build_path(path_, KITCHEN_FOLDER, TRASH_FOLDER);
+
+            if (filesystem::move_to_trash(path, trash) != PREP_SUCCESS) {
+                log::debug("unable to move ", path, " to the trash: ", strerror(errno));
+
+                return filesystem::remove_directory(path);
+            }
+
+            if (filesystem::empty_trash(trash) != PREP_SUCCESS) {
+                log::debug("unable to empty the trash");
+            }
+
+            return PREP_SUCCESS;
+        }
+
         int Repository::save_meta(const Package &config) const
         {
             if (path_.empty()) {
@@ -321,6 +785,17 @@ namespace micrantha
 
             out.close();
 
+            out.open(filesystem::build_path(metaDir, PREFIX_FILE));
+
+            if (!out.is_open()) {
+                log::error("unable to save prefix for ", config.name());
+                return PREP_FAILURE;
+            }
+
+            out << path_ << std::endl;
+
+            out.close();
+
             if (config.has_path()) {
                 log::trace("copying ", config.path(), " to ", metaDir, "...");
 
@@ -364,6 +839,50 @@ namespace micrantha
             return PREP_FAILURE;
         }
 
+        int Repository::relocate(const Package &config) const
+        {
+            auto metaDir = get_meta_path(config.name());
+
+            std::ifstream in(filesystem::build_path(metaDir, PREFIX_FILE));
+
+            std::string prefix;
+
+            // packages from before prefixes were kept are left as they are
+            if (!std::getline(in, prefix) || prefix.empty() || prefix == path_) {
+                return PREP_FAILURE;
+            }
+
+            in.close();
+
+            auto installPath = get_install_path(config.name());
+
+            if (filesystem::directory_exists(installPath) != PREP_SUCCESS) {
+                return PREP_FAILURE;
+            }
+
+            log::info("relocating ", color::m(config.name()), " from ", prefix);
+
+            relocate::Stats stats;
+
+            if (relocate::rewrite_tree(installPath, prefix, path_, stats) != PREP_SUCCESS) {
+                log::error("unable to relocate ", config.name(), " [", strerror(errno), "]");
+                return PREP_ERROR;
+            }
+
+            log::debug("relocated ", stats.files, " files of ", config.name());
+
+            if (stats.skipped > 0) {
+                log::warn(stats.skipped, " binary files of ", config.name(), " still refer to ", prefix,
+                          ", the new path is longer");
+            }
+
+            std::ofstream out(filesystem::build_path(metaDir, PREFIX_FILE));
+
+            out << path_ << std::endl;
+
+            return PREP_SUCCESS;
+        }
+
         bool Repository::exists(const Package &config) const {
             std::string metaDir = filesystem::build_path(GLOBAL_REPO, KITCHEN_FOLDER, META_FOLDER, config.name());
 
@@ -440,151 +959,321 @@ namespace micrantha
 
         int Repository::link_directory(const std::string &path) const
         {
-            FTS *file_system = nullptr;
-            FTSENT *parent = nullptr;
             int rval = PREP_SUCCESS;
-            char buf[PATH_MAX + 1] = {0};
-            struct stat st, mode;
+            struct stat mode;
 
             if (filesystem::directory_exists(path) != PREP_SUCCESS) {
                 log::error(path, " is not a directory");
                 return PREP_FAILURE;
             }
 
-            char *const paths[] = {(char *const)path.c_str(), nullptr};
-
-            file_system = fts_open(paths, FTS_COMFOLLOW | FTS_NOCHDIR, nullptr);
-
-            if (file_system == nullptr) {
-                log::error("unable to open file system [", strerror(errno), "]");
-                return PREP_FAILURE;
-            }
-
             if (stat(path.c_str(), &mode)) {
                 log::perror("stat");
                 return PREP_FAILURE;
             }
 
-            while ((parent = fts_read(file_system)) != nullptr) {
+            auto metaDir = get_meta_path(internal::package_name(path));
+
+            // regular files in the repository are only replaced if they are known to be this package's
+            auto copies = internal::read_copies(metaDir);
+
+            // the files are linked in batches once the folders are made
+            std::vector<internal::Linked> files;
+
+            walk::Options options;
+
+            options.follow_root = true;
+
+            options.enter = [this, &mode, &rval](const walk::Entry &entry) {
+                struct stat st;
 
                 // get the repo path
-                snprintf(buf, PATH_MAX, "%s%s", path_.c_str(), parent->fts_path + path.length());
+                auto dir = entry.depth == 0 ? path_ : filesystem::build_path(path_, entry.path());
 
                 // check the install file is a directory
-                if (parent->fts_info == FTS_D) {
-                    if (stat(buf, &st) == 0) {
-                        if (S_ISDIR(st.st_mode)) {
-                            log::trace("directory ", buf, " already exists");
-                        } else {
-                            log::error("non-directory file already found for ", buf);
-                            rval = PREP_FAILURE;
-                        }
-                        continue;
-                    }
-
-                    // doesn't exist, create the repo path directory
-                    if (filesystem::create_path(buf, mode.st_mode)) {
-                        log::error("Could not create ", buf, " [", strerror(errno), "]");
+                if (stat(dir.c_str(), &st) == 0) {
+                    if (S_ISDIR(st.st_mode)) {
+                        log::trace("directory ", dir, " already exists");
+                    } else {
+                        log::error("non-directory file already found for ", dir);
                         rval = PREP_FAILURE;
-                        break;
                     }
+                    return walk::NEXT;
+                }
 
+                // doesn't exist, create the repo path directory
+                if (filesystem::create_path(dir, mode.st_mode)) {
+                    log::error("Could not create ", dir, " [", strerror(errno), "]");
+                    rval = PREP_FAILURE;
+                    return walk::STOP;
+                }
+
+                return walk::NEXT;
+            };
+
+            options.file = [this, &path, &files](const walk::Entry &entry) {
+                auto relative = entry.path();
+
+                if (entry.type != DT_REG) {
+                    log::debug("skipping non-regular file ", filesystem::build_path(path_, relative));
+                    return walk::NEXT;
+                }
+
+                internal::Linked file{filesystem::build_path(path, relative), filesystem::build_path(path_, relative),
+                                      relative, {}, {}, false};
+
+                // compared with what is there, a hard link shares the inode
+                if (fstatat(entry.dirfd, entry.name, &file.st, 0) == -1) {
+                    log::debug("unable to stat ", file.from, " [", strerror(errno), "]");
+                }
+
+                files.push_back(std::move(file));
+
+                return walk::NEXT;
+            };
+
+            options.error = [&path](const walk::Entry &entry, int error) {
+                log::error("unable to read ", filesystem::build_path(path, entry.path()), " [", strerror(error), "]");
+            };
+
+            if (walk::tree(path, options) == PREP_ERROR) {
+                rval = PREP_FAILURE;
+            }
+
+            batch::Queue queue;
+
+            // find what is in the way
+            for (auto &file : files) {
+                queue.lstat(file.to, &file.existing, [&file](int result) { file.found = result == 0; });
+            }
+
+            queue.flush();
+
+            auto end = files.end();
+
+            for (auto it = files.begin(); it != files.end(); ++it) {
+                if (!it->found) {
                     continue;
                 }
 
-                if (parent->fts_info != FTS_F) {
-                    log::debug("skipping non-regular file ", buf);
+                // already a hard link to the file
+                if (linkMode_ == LinkMode::HARDLINK && it->existing.st_dev == it->st.st_dev &&
+                    it->existing.st_ino == it->st.st_ino) {
+                    copies.erase(it->relative);
+                    it->to.clear();
                     continue;
                 }
 
-                if (lstat(buf, &st) == 0) {
-                    if (!S_ISLNK(st.st_mode)) {
-                        log::error("File already exists and is not a link");
-                        rval = PREP_FAILURE;
-                        break;
-                    }
+                if (!internal::is_linked(*it, copies)) {
+                    log::error("File ", it->to, " already exists and is not a link");
+                    rval = PREP_FAILURE;
+                    end = it;
+                    break;
+                }
 
-                    if (unlink(buf)) {
-                        log::error("unable to unlink existing [", strerror(errno), "]");
-                        continue;
+                auto &to = it->to;
+
+                queue.unlink(to, [&to](int result) {
+                    if (result < 0) {
+                        log::error("unable to unlink existing [", strerror(-result), "]");
+                        to.clear();
                     }
+                });
+            }
+
+            queue.flush();
+
+            // the first file that could not be linked
+            int error = 0;
+
+            for (auto it = files.begin(); it != end; ++it) {
+                if (it->to.empty()) {
+                    continue;
                 }
 
-                log::debug("linking [", parent->fts_path, "] to [", buf, "]");
+                log::debug("linking [", it->from, "] to [", it->to, "]");
 
-                if (symlink(parent->fts_path, buf)) {
-                    log::error("unable to link [", strerror(errno), "]");
-                    rval = PREP_FAILURE;
-                    break;
+                const auto &file = *it;
+
+                copies.erase(file.relative);
+
+                switch (linkMode_) {
+                    case LinkMode::SYMLINK:
+                        queue.symlink(file.from, file.to, [&error](int result) {
+                            if (result < 0 && error == 0) {
+                                error = -result;
+                            }
+                        });
+                        break;
+                    case LinkMode::HARDLINK:
+                        queue.link(file.from, file.to, [&file, &copies, &error](int result) {
+                            if (result == 0) {
+                                return;
+                            }
+                            // another file system, or not allowed
+                            if (result == -EXDEV || result == -EPERM || result == -EMLINK) {
+                                log::debug("unable to hard link [", strerror(-result), "], copying ", file.to);
+
+                                copies.insert(file.relative);
+
+                                if (filesystem::copy_file(file.from, file.to) == PREP_SUCCESS) {
+                                    return;
+                                }
+                                result = -errno;
+                            }
+                            if (error == 0) {
+                                error = -result;
+                            }
+                        });
+                        break;
+                    default:
+                        // copies, nothing to batch
+                        copies.insert(file.relative);
+
+                        if (link_file(file.from.c_str(), file.to.c_str()) && error == 0) {
+                            error = errno;
+                        }
+                        break;
                 }
             }
 
-            fts_close(file_system);
+            queue.flush();
+
+            if (error != 0) {
+                log::error("unable to link [", strerror(error), "]");
+                rval = PREP_FAILURE;
+            }
+
+            // unlinking needs to know which files in the repository are copies, even of a partial link
+            if (filesystem::directory_exists(metaDir) == PREP_SUCCESS &&
+                internal::write_copies(metaDir, copies) != PREP_SUCCESS) {
+                log::error("unable to keep the copies of ", path);
+                rval = PREP_FAILURE;
+            }
+
+            if (rval == PREP_SUCCESS && filesystem::directory_exists(metaDir) == PREP_SUCCESS) {
+                std::ofstream out(filesystem::build_path(metaDir, LINK_FILE));
+
+                out << internal::to_string(linkMode_) << std::endl;
+
+                unlink(filesystem::build_path(metaDir, UNLINKED_FILE).c_str());
+            }
+
+            // the repository has new or fewer lib and include dirs to offer
+            environment::invalidate();
 
             return rval;
         }
 
         int Repository::unlink_directory(const std::string &path) const
         {
-            FTS *file_system = nullptr;
-            FTSENT *parent = nullptr;
             int rval = PREP_SUCCESS;
-            char buf[PATH_MAX + 1] = {0};
-            std::string installDir;
 
             if (filesystem::directory_exists(path) != PREP_SUCCESS) {
                 log::error(path, " does not exist.");
                 return PREP_FAILURE;
             }
 
-            char *const paths[] = {(char *const)path.c_str(), nullptr};
+            auto metaDir = get_meta_path(internal::package_name(path));
 
-            file_system = fts_open(paths, FTS_COMFOLLOW | FTS_NOCHDIR, nullptr);
+            // regular files in the repository are only removed if they are known to be this package's
+            auto copies = internal::read_copies(metaDir);
 
-            if (file_system == nullptr) {
-                log::error("unable to open file system [", strerror(errno), "]");
+            // the files are unlinked in batches
+            std::vector<internal::Linked> files;
+
+            walk::Options options;
+
+            options.follow_root = true;
+
+            options.file = [this, &path, &files](const walk::Entry &entry) {
+                auto relative = entry.path();
+
+                internal::Linked file{filesystem::build_path(path, relative), filesystem::build_path(path_, relative),
+                                      relative, {}, {}, false};
+
+                // compared with what is there, a hard link shares the inode
+                if (fstatat(entry.dirfd, entry.name, &file.st, AT_SYMLINK_NOFOLLOW) == -1) {
+                    log::debug("unable to stat ", file.from, " [", strerror(errno), "]");
+                }
+
+                files.push_back(std::move(file));
+
+                return walk::NEXT;
+            };
+
+            options.error = [&path](const walk::Entry &entry, int error) {
+                log::error("unable to read ", filesystem::build_path(path, entry.path()), " [", strerror(error), "]");
+            };
+
+            if (walk::tree(path, options) == PREP_ERROR) {
                 return PREP_FAILURE;
             }
 
-            size_t plength = path.length();
+            batch::Queue queue;
 
-            while ((parent = fts_read(file_system)) != nullptr) {
-                struct stat st = {};
+            for (auto &file : files) {
+                queue.lstat(file.to, &file.existing, [&file](int result) {
+                    file.found = result == 0;
 
-                if (parent->fts_info == FTS_D) {
-                    log::debug("skipping directory ", parent->fts_path);
-                    continue;
-                }
+                    if (!file.found) {
+                        log::debug(file.to, " not found (", strerror(-result), "), skipping");
+                    }
+                });
+            }
 
-                // get the repo path
-                snprintf(buf, PATH_MAX, "%s%s", path_.c_str(), parent->fts_path + plength);
+            queue.flush();
+
+            // the first file that could not be unlinked
+            int error = 0;
 
-                if (lstat(buf, &st)) {
-                    log::debug(buf, " not found (", strerror(errno), "), skipping");
+            for (const auto &file : files) {
+                if (!file.found) {
                     continue;
                 }
 
-                if (S_ISDIR(st.st_mode)) {
-                    log::debug("skipping directory ", buf);
+                if (S_ISDIR(file.existing.st_mode)) {
+                    log::debug("skipping directory ", file.to);
                     continue;
                 }
 
-                if (!S_ISLNK(st.st_mode)) {
-                    log::error(buf, " is not a link, skipping");
+                // hard links, reflinks and copies are regular files, anyone's but this package's are kept
+                if (!internal::is_linked(file, copies)) {
+                    log::error(file.to, " is not a link, skipping");
                     rval = PREP_FAILURE;
                     continue;
                 }
 
-                log::debug("unlinking [", buf, "]");
+                log::debug("unlinking [", file.to, "]");
 
-                if (unlink(buf)) {
-                    log::error("unable to unlink [", strerror(errno), "]");
-                    rval = PREP_FAILURE;
-                    break;
-                }
+                queue.unlink(file.to, [&file, &copies, &error](int result) {
+                    if (result == 0) {
+                        copies.erase(file.relative);
+                    } else if (error == 0) {
+                        error = -result;
+                    }
+                });
             }
 
-            fts_close(file_system);
+            queue.flush();
+
+            if (error != 0) {
+                log::error("unable to unlink [", strerror(error), "]");
+                rval = PREP_FAILURE;
+            }
+
+            if (filesystem::directory_exists(metaDir) == PREP_SUCCESS &&
+                internal::write_copies(metaDir, copies) != PREP_SUCCESS) {
+                log::error("unable to keep the copies of ", path);
+                rval = PREP_FAILURE;
+            }
+
+            if (rval == PREP_SUCCESS) {
+                unlink(filesystem::build_path(metaDir, LINK_FILE).c_str());
+            }
+
+            // the repository has new or fewer lib and include dirs to offer
+            environment::invalidate();
 
             return rval;
         }
@@ -615,11 +1304,25 @@ namespace micrantha
         {
             log::trace("checking plugins for resolving [", config.name(), "]...");
 
+            auto sourcePath = get_source_path(config.name());
+
+            // a previous run may have already resolved this exact package
+            auto result = find_resolved(config, sourcePath);
+
+            if (result == PREP_SUCCESS) {
+                return result;
+            }
+
             for (const auto &plugin : validPlugins_) {
 
-                auto result = plugin->on_resolve(config, get_source_path(config.name()));
+                result = plugin->on_resolve(config, sourcePath);
+
                 if (result == PREP_SUCCESS) {
                     log::info("resolved ", color::m(config.name()), " from plugin ", color::c(plugin->name()));
+
+                    if (save_resolved(internal::resolve_key(plugin, config), sourcePath, result)) {
+                        log::warn("unable to save resolve of ", config.name());
+                    }
                     return result;
                 }
             }
@@ -630,20 +1333,222 @@ namespace micrantha
         {
             log::trace("checking plugins for resolving [", location, "]...");
 
-            auto tempDir = filesystem::make_temp_dir();
+            // locations get a stable folder so repeated resolves are reused
+            auto sourcePath = get_source_path(string::hash(location));
 
             for (const auto &plugin : validPlugins_) {
 
-                auto result = plugin->on_resolve(location, tempDir);
+                if (!internal::can_resolve(plugin)) {
+                    continue;
+                }
+
+                auto result = find_resolved(internal::resolve_key(plugin, location), sourcePath);
+
+                if (result == PREP_SUCCESS) {
+                    log::info("using resolved ", color::m(location), " from plugin ", color::c(plugin->name()));
+                    return result;
+                }
+            }
+
+            // anything left over is from a stale or failed resolve
+            if (filesystem::directory_exists(sourcePath) == PREP_SUCCESS && discard(sourcePath) != PREP_SUCCESS) {
+                log::error("unable to clean ", sourcePath);
+                return PREP_FAILURE;
+            }
+
+            if (filesystem::create_path(sourcePath) != PREP_SUCCESS) {
+                log::perror("create ", sourcePath);
+                return PREP_FAILURE;
+            }
+
+            for (const auto &plugin : validPlugins_) {
+
+                auto result = plugin->on_resolve(location, sourcePath);
 
                 if (result == PREP_SUCCESS) {
                     log::info("resolved ", color::m(location), " from plugin ", color::c(plugin->name()));
+
+                    if (save_resolved(internal::resolve_key(plugin, location), sourcePath, result)) {
+                        log::warn("unable to save resolve of ", location);
+                    }
+                    return result;
+                }
+            }
+
+            filesystem::remove_directory(sourcePath);
+
+            return PREP_FAILURE;
+        }
+
+        void Repository::notify_plugins_resolve(Scheduler &scheduler, const Package &config,
+                                                const resolver_callback &callback)
+        {
+            log::trace("checking plugins for resolving [", config.name(), "]...");
+
+            auto sourcePath = get_source_path(config.name());
+
+            auto result = find_resolved(config, sourcePath);
+
+            if (result == PREP_SUCCESS) {
+                callback(result);
+                return;
+            }
+
+            resolve_next(scheduler, config, sourcePath, validPlugins_.cbegin(), callback);
+        }
+
+        void Repository::resolve_next(Scheduler &scheduler, const Package &config, const std::string &sourcePath,
+                                      std::list<std::shared_ptr<Plugin>>::const_iterator it,
+                                      const resolver_callback &callback)
+        {
+            if (it == validPlugins_.cend()) {
+                callback(PREP_FAILURE);
+                return;
+            }
+
+            auto plugin = *it;
+
+            auto done = [this, &scheduler, &config, sourcePath, plugin, it, callback](const Plugin::Result &result) {
+                if (result != PREP_SUCCESS) {
+                    resolve_next(scheduler, config, sourcePath, std::next(it), callback);
+                    return;
+                }
+
+                log::info("resolved ", color::m(config.name()), " from plugin ", color::c(plugin->name()));
+
+                if (save_resolved(internal::resolve_key(plugin, config), sourcePath, result)) {
+                    log::warn("unable to save resolve of ", config.name());
+                }
+
+                callback(result);
+            };
+
+            // a shared plugin has no process to wait on
+            if (plugin->is_shared()) {
+                done(plugin->on_resolve(config, sourcePath));
+                return;
+            }
+
+            scheduler.submit([plugin, &config, sourcePath]() { return plugin->start_resolve(config, sourcePath); }, done);
+        }
+
+#ifdef HAVE_COROUTINES
+        Task<Plugin::Result> Repository::notify_plugins_resolve(Scheduler &scheduler, const Package &config)
+        {
+            log::trace("checking plugins for resolving [", config.name(), "]...");
+
+            auto sourcePath = get_source_path(config.name());
+
+            auto result = find_resolved(config, sourcePath);
+
+            if (result == PREP_SUCCESS) {
+                co_return result;
+            }
+
+            for (const auto &plugin : validPlugins_) {
+
+                // a shared plugin has no process to wait on
+                if (plugin->is_shared()) {
+                    result = plugin->on_resolve(config, sourcePath);
+                } else {
+                    result = co_await scheduler.submit([&plugin, &config, &sourcePath]() {
+                        return plugin->start_resolve(config, sourcePath);
+                    });
+                }
+
+                if (result == PREP_SUCCESS) {
+                    log::info("resolved ", color::m(config.name()), " from plugin ", color::c(plugin->name()));
+
+                    if (save_resolved(internal::resolve_key(plugin, config), sourcePath, result)) {
+                        log::warn("unable to save resolve of ", config.name());
+                    }
+                    co_return result;
+                }
+            }
+
+            co_return PREP_FAILURE;
+        }
+#endif
+
+        Plugin::Result Repository::find_resolved(const Package &config, const std::string &sourcePath) const
+        {
+            for (const auto &plugin : validPlugins_) {
+
+                if (!internal::can_resolve(plugin)) {
+                    continue;
+                }
+
+                auto result = find_resolved(internal::resolve_key(plugin, config), sourcePath);
+
+                if (result == PREP_SUCCESS) {
+                    log::info("using resolved ", color::m(config.name()), " from plugin ", color::c(plugin->name()));
                     return result;
                 }
             }
+
             return PREP_FAILURE;
         }
 
+        Plugin::Result Repository::find_resolved(const std::string &key, const std::string &sourcePath) const
+        {
+            std::ifstream in(sourcePath + RESOLVE_EXT);
+
+            if (!in.is_open()) {
+                return PREP_FAILURE;
+            }
+
+            std::string line;
+
+            if (!std::getline(in, line) || line != string::hash(key)) {
+                log::trace("resolve record for ", sourcePath, " is out of date");
+                return PREP_FAILURE;
+            }
+
+            std::vector<std::string> values;
+
+            while (std::getline(in, line)) {
+                values.push_back(line);
+            }
+
+            // the source must still be where the plugin left it
+            if (values.empty() || filesystem::directory_exists(values.front()) != PREP_SUCCESS) {
+                return PREP_FAILURE;
+            }
+
+            internal::touch(sourcePath);
+
+            return {PREP_SUCCESS, values};
+        }
+
+        int Repository::save_resolved(const std::string &key, const std::string &sourcePath,
+                                      const Plugin::Result &result) const
+        {
+            if (result.values.empty()) {
+                return PREP_SUCCESS;
+            }
+
+            // values are recorded a line each, so one spanning lines is not recorded at all
+            for (const auto &value : result.values) {
+                if (value.find('\n') != std::string::npos) {
+                    return PREP_SUCCESS;
+                }
+            }
+
+            std::ofstream out(sourcePath + RESOLVE_EXT);
+
+            if (!out.is_open()) {
+                return PREP_FAILURE;
+            }
+
+            out << string::hash(key) << std::endl;
+
+            for (const auto &value : result.values) {
+                out << value << std::endl;
+            }
+
+            return PREP_SUCCESS;
+        }
+
         int Repository::notify_plugins_add(const Package &config)
         {
             log::trace("checking plugins for install of [", config.name(), "]...");
@@ -683,7 +1588,8 @@ namespace micrantha
         }
 
         int Repository::notify_plugins_build(const Package &config, const std::string &sourcePath,
-                                             const std::string &buildPath, const std::string &installPath)
+                                             const std::string &buildPath, const std::string &installPath,
+                                             const environment::Snapshot &env)
         {
             for (const auto &name : config.build_system()) {
                 auto plugin = get_plugin_by_name(name);
@@ -693,7 +1599,7 @@ namespace micrantha
                     return PREP_FAILURE;
                 }
 
-                if (plugin->on_build(config, sourcePath, buildPath, installPath) == PREP_FAILURE) {
+                if (plugin->on_build(config, sourcePath, buildPath, installPath, env) == PREP_FAILURE) {
                     return PREP_FAILURE;
                 }
             }
@@ -701,7 +1607,8 @@ namespace micrantha
         }
 
 
-        int Repository::notify_plugins_test(const Package &config, const std::string &sourcePath, const std::string &buildPath)
+        int Repository::notify_plugins_test(const Package &config, const std::string &sourcePath, const std::string &buildPath,
+                                            const environment::Snapshot &env)
         {
             for (const auto &name : config.build_system()) {
                 auto plugin = get_plugin_by_name(name);
@@ -711,7 +1618,7 @@ namespace micrantha
                     return PREP_FAILURE;
                 }
 
-                if (plugin->on_test(config, sourcePath, buildPath) == PREP_FAILURE) {
+                if (plugin->on_test(config, sourcePath, buildPath, env) == PREP_FAILURE) {
                     return PREP_FAILURE;
                 }
             }
@@ -720,7 +1627,7 @@ namespace micrantha
 
 
         int Repository::notify_plugins_install(const Package &config,const std::string &sourcePath,
-                                               const std::string &buildPath)
+                                               const std::string &buildPath, const environment::Snapshot &env)
         {
             for (const auto &name : config.build_system()) {
                 auto plugin = get_plugin_by_name(name);
@@ -730,7 +1637,7 @@ namespace micrantha
                     return PREP_FAILURE;
                 }
 
-                if (plugin->on_install(config, sourcePath, buildPath) == PREP_FAILURE) {
+                if (plugin->on_install(config, sourcePath, buildPath, env) == PREP_FAILURE) {
                     return PREP_FAILURE;
                 }
             }
@@ -2,20 +2,33 @@
 #ifndef MICRANTHA_PREP_REPOSITORY_H
 #define MICRANTHA_PREP_REPOSITORY_H
 
+#include <cstdint>
+#include <ctime>
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "package.h"
 #include "plugin.h"
+#include "task.h"
 
 namespace micrantha {
     namespace prep {
+        class Scheduler;
+
         /**
          * a representation of a repository.  can be local or global
          */
         class Repository {
         public:
+            /**
+             * how installed files are linked into the repository
+             */
+            enum class LinkMode : int {
+                SYMLINK, HARDLINK, REFLINK, COPY
+            };
+
 #ifdef _WIN32
             constexpr static const char *const UNKNOWN_INSTALL_FOLDER = "C:\\Windows\\Temp\\Unknown";
             constexpr static const char *const GLOBAL_REPO = "C:\\prep";
@@ -59,21 +72,98 @@ namespace micrantha {
              */
             constexpr static const char *BIN_FOLDER = "bin";
 
+            /**
+             * library folder in the repository
+             */
+            constexpr static const char *LIB_FOLDER = "lib";
+
             /**
              * plugins folder in the repository
              */
             constexpr static const char *PLUGIN_FOLDER = "plugins";
 
+            /**
+             * hook output folder in the kitchen
+             */
+            constexpr static const char *LOGS_FOLDER = "logs";
+
+            /**
+             * folders waiting to be removed in the background, in the kitchen
+             */
+            constexpr static const char *TRASH_FOLDER = "trash";
+
             /**
              * version information file
              */
             constexpr static const char *VERSION_FILE = "version";
 
+            /**
+             * the repository path a package was built in, for relocating it
+             */
+            constexpr static const char *PREFIX_FILE = "prefix";
+
             /**
              * the file name for package configuration
              */
             constexpr static const char *PACKAGE_FILE = "package.json";
 
+            /**
+             * the repository settings file
+             */
+            constexpr static const char *CONFIG_FILE = "config.json";
+
+            /**
+             * the link mode a package was linked with, kept with its meta data
+             */
+            constexpr static const char *LINK_FILE = "link";
+
+            /**
+             * the files a package copied into the repository, kept with its meta data
+             */
+            constexpr static const char *COPIES_FILE = "copies";
+
+            /**
+             * marks a package installed but not yet linked, kept with its meta data
+             */
+            constexpr static const char *UNLINKED_FILE = "unlinked";
+
+            /**
+             * marks a package whose executables and libraries all have their runpath set, kept with its meta data
+             */
+            constexpr static const char *RUNPATH_FILE = "runpath";
+
+            /**
+             * extension of the record kept beside a resolved source folder
+             */
+            constexpr static const char *RESOLVE_EXT = ".resolved";
+
+            /**
+             * limits on what the kitchen keeps, set with "gc" in the repository settings
+             */
+            typedef struct {
+                // the most bytes of sources, builds and installs to keep, zero for no limit
+                uint64_t max_size;
+                // the longest a package folder is kept unused, in seconds, zero for no limit
+                time_t max_age;
+                // collect garbage before a command when fewer bytes are free, zero to never
+                uint64_t min_free;
+            } Budget;
+
+            /**
+             * a package folder in the kitchen
+             */
+            typedef struct {
+                // the package, or the hashed location of a resolved source
+                std::string name;
+                std::string path;
+                // SOURCE_FOLDER, BUILD_FOLDER or INSTALL_FOLDER
+                const char *kind;
+                // when prep last used it
+                time_t used;
+                // the space it takes on disk
+                uint64_t size;
+            } Folder;
+
             /**
              * a callback for resolving plugins
              */
@@ -84,16 +174,63 @@ namespace micrantha {
              */
             static std::string const get_local_repo();
 
+            /**
+             * empties the trash folder of a repository, for the process filesystem::empty_trash starts
+             * @param path the trash folder, refused unless it is a kitchen trash folder
+             * @return PREP_SUCCESS if the trash was emptied, otherwise PREP_FAILURE
+             */
+            static int remove_trash(const std::string &path);
+
             /**
              * unlinks a folder in this repository
              */
             int unlink_directory(const std::string &path) const;
 
             /**
-             * links a folder in this repository
+             * links a folder in this repository, with the link mode of the repository
              */
             int link_directory(const std::string &path) const;
 
+            /**
+             * the link mode property, set with "link_mode" in the repository settings
+             */
+            LinkMode link_mode() const;
+
+            /**
+             * the garbage collection budget property
+             */
+            const Budget &budget() const;
+
+            /**
+             * marks the source, build and install folders of a package as used now
+             */
+            void mark_used(const std::string &package_name) const;
+
+            /**
+             * records that a package was installed without being linked, until it is linked
+             */
+            int mark_unlinked(const std::string &package_name) const;
+
+            /**
+             * tests if a package was installed and has not been linked since
+             */
+            bool is_unlinked(const std::string &package_name) const;
+
+            /**
+             * records whether every executable and library of a package was given a runpath
+             */
+            int mark_runpaths(const std::string &package_name, bool complete) const;
+
+            /**
+             * tests if every executable and library of a package was given a runpath
+             */
+            bool has_runpaths(const std::string &package_name) const;
+
+            /**
+             * lists the source, build and install folders in the kitchen with their size and last use
+             */
+            std::vector<Folder> package_folders() const;
+
             /**
              * saves meta data for a package
              */
@@ -104,6 +241,13 @@ namespace micrantha {
              */
             int has_meta(const Package &config) const;
 
+            /**
+             * moves a package built in another repository path to this one, replacing the old path
+             * in its installed files
+             * @return PREP_SUCCESS if relocated, PREP_FAILURE if there was nothing to relocate, or PREP_ERROR
+             */
+            int relocate(const Package &config) const;
+
             /**
              * counts the dependencies for a package name in the entire repository
              */
@@ -128,6 +272,9 @@ namespace micrantha {
             // bin path property
             std::string get_bin_path() const;
 
+            // lib path property
+            std::string get_lib_path() const;
+
             // build path property
             std::string get_build_path(const std::string &package_name) const;
 
@@ -139,6 +286,21 @@ namespace micrantha {
             // plugin path property
             std::string get_plugin_path() const;
 
+            // kitchen path property
+            std::string get_kitchen_path() const;
+
+            /**
+             * log path property, holding a log for each hook run on a package
+             */
+            std::string get_log_path(const std::string &package_name) const;
+
+            /**
+             * removes a folder in the repository without waiting.  the folder is moved to the trash
+             * and removed by a background process, or removed in place if it can not be moved.
+             * @return PREP_SUCCESS or PREP_FAILURE if it could not be removed
+             */
+            int discard(const std::string &path) const;
+
             /**
              * check if a package exists in either the global or local repository
              * @param config the package config to check
@@ -167,6 +329,25 @@ namespace micrantha {
              */
             Plugin::Result notify_plugins_resolve(const std::string &location);
 
+            /**
+             * runs the resolve callback on plugins for a config without waiting for it
+             * @param scheduler runs the resolving plugins
+             * @param config the package to resolve, kept until the scheduler has run
+             * @param callback receives the result of the resolve
+             */
+            void notify_plugins_resolve(Scheduler &scheduler, const Package &config,
+                                        const resolver_callback &callback);
+
+#ifdef HAVE_COROUTINES
+            /**
+             * runs the resolve callback on plugins for a config as a task, so resolves can be awaited side by side
+             * @param scheduler runs the resolving plugins
+             * @param config the package to resolve, kept until the task is done
+             * @return the result of the resolve
+             */
+            Task<Plugin::Result> notify_plugins_resolve(Scheduler &scheduler, const Package &config);
+#endif
+
             /**
              * runs the remove callback on plugins for a config
              */
@@ -174,19 +355,24 @@ namespace micrantha {
 
             /**
              * runs the build callback on plugins for a config
+             * @param env the environment to build in
              */
             int notify_plugins_build(const Package &config, const std::string &sourcePath, const std::string &buildPath,
-                                     const std::string &installPath);
+                                     const std::string &installPath, const environment::Snapshot &env);
 
             /**
              * runs the build callback on plugins for a config
+             * @param env the environment to test in
              */
-            int notify_plugins_test(const Package &config, const std::string &sourcePath, const std::string &buildPath);
+            int notify_plugins_test(const Package &config, const std::string &sourcePath, const std::string &buildPath,
+                                    const environment::Snapshot &env);
 
             /**
              * runs the build callback on plugins for a config
+             * @param env the environment to install in
              */
-            int notify_plugins_install(const Package &config, const std::string &sourcePath, const std::string &buildPath);
+            int notify_plugins_install(const Package &config, const std::string &sourcePath, const std::string &buildPath,
+                                       const environment::Snapshot &env);
 
             /**
              * gets a plugin by name
@@ -214,6 +400,49 @@ namespace micrantha {
 
             int initialize_kitchen() const;
 
+            /**
+             * reads the repository settings, if there are any
+             * @return PREP_SUCCESS or PREP_FAILURE if the settings are not valid
+             */
+            int read_config();
+
+            /**
+             * links one file into the repository.  hard links and reflinks fall back to copying
+             * when the file system can not make them.
+             * @return PREP_SUCCESS or PREP_FAILURE with errno set
+             */
+            int link_file(const char *from, const char *to) const;
+
+            /**
+             * looks up a previous resolve of a source folder
+             * @param key the key the source was resolved with
+             * @param sourcePath the resolved source folder
+             * @return the cached result or PREP_FAILURE if no valid record exists
+             */
+            Plugin::Result find_resolved(const std::string &key, const std::string &sourcePath) const;
+
+            /**
+             * looks up a previous resolve of a package by any resolver plugin
+             * @return the cached result or PREP_FAILURE if no valid record exists
+             */
+            Plugin::Result find_resolved(const Package &config, const std::string &sourcePath) const;
+
+            /**
+             * records a resolve of a source folder for later runs
+             * @param key the key the source was resolved with
+             * @param sourcePath the resolved source folder
+             * @param result the result of the resolving plugin
+             * @return PREP_SUCCESS or PREP_FAILURE upon error
+             */
+            int save_resolved(const std::string &key, const std::string &sourcePath, const Plugin::Result &result) const;
+
+            /**
+             * resolves a config with a plugin, moving on to the next plugin if it fails
+             */
+            void resolve_next(Scheduler &scheduler, const Package &config, const std::string &sourcePath,
+                              std::list<std::shared_ptr<Plugin>>::const_iterator plugin,
+                              const resolver_callback &callback);
+
             /**
              * validates the plugins
              * @return PREP_SUCCESS or PREP_FAILURE if any plugin invalid
@@ -226,6 +455,10 @@ namespace micrantha {
             std::list<std::shared_ptr<Plugin>> plugins_;
             // the repository path
             std::string path_;
+            // how packages are linked into the repository
+            LinkMode linkMode_ = LinkMode::SYMLINK;
+            // what the kitchen keeps
+            Budget budget_ = {0, 0, 0};
         };
     }
 }
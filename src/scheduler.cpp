@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <csignal>
+#include <sys/wait.h>
+#include <thread>
+
+#include "common.h"
+#include "log.h"
+#include "scheduler.h"
+
+namespace micrantha {
+    namespace prep {
+
+        Scheduler::Scheduler(size_t limit) : limit_(limit) {
+            // hooks mostly wait on the network or disk, so run more than there are processors
+            if (limit_ == 0) {
+                limit_ = std::max<size_t>(MIN_LIMIT, std::thread::hardware_concurrency() * 2);
+            }
+        }
+
+        Scheduler::~Scheduler() {
+            for (const auto &entry : running_) {
+                if (entry.second.exited) {
+                    continue;
+                }
+
+                kill(entry.first, SIGKILL);
+                waitpid(entry.first, nullptr, 0);
+            }
+        }
+
+        void Scheduler::submit(const starter &start, const callback &done) {
+            queue_.push_back({start, done});
+        }
+
+#ifdef HAVE_COROUTINES
+        Callback<Plugin::Result> Scheduler::submit(const starter &start) {
+            return Callback<Plugin::Result>([this, start](const callback &done) { submit(start, done); });
+        }
+#endif
+
+        int Scheduler::run() {
+            start_pending();
+
+            while (!running_.empty()) {
+                long timeout = -1;
+
+                // wake up in time to forward output that is waiting, or to enforce a time limit
+                for (const auto &entry : running_) {
+                    for (auto due : {entry.second.job->due(), entry.second.job->deadline()}) {
+                        if (due >= 0 && (timeout < 0 || due < timeout)) {
+                            timeout = due;
+                        }
+                    }
+                }
+
+                if (loop_.run_once(timeout) == PREP_ERROR) {
+                    return PREP_ERROR;
+                }
+
+                for (const auto &entry : running_) {
+                    if (entry.second.job->due() == 0) {
+                        entry.second.job->flush();
+                    }
+
+                    if (entry.second.job->deadline() == 0) {
+                        entry.second.job->enforce_deadline();
+                    }
+                }
+
+                start_pending();
+            }
+
+            return PREP_SUCCESS;
+        }
+
+        void Scheduler::start_pending() {
+            while (running_.size() < limit_ && !queue_.empty()) {
+                auto task = queue_.front();
+
+                queue_.pop_front();
+
+                auto job = task.start();
+
+                if (job == nullptr) {
+                    task.done(PREP_ERROR);
+                    continue;
+                }
+
+                auto pid = job->child().pid;
+
+                running_[pid] = {job, task.done, 0, false, 0};
+
+                if (watch(pid) == PREP_ERROR) {
+                    log::error("unable to watch plugin process ", pid);
+                    // its exit is still watched, so the hook finishes as killed
+                    kill(pid, SIGKILL);
+                }
+            }
+        }
+
+        int Scheduler::watch(pid_t pid) {
+            auto &running = running_[pid];
+            auto &child = running.job->child();
+
+            for (auto fd : {child.output, child.error}) {
+                if (fd == -1) {
+                    continue;
+                }
+
+                if (loop_.watch(fd, [this, pid](int fd) {
+                        auto it = running_.find(pid);
+
+                        if (it == running_.end() || it->second.job->read(fd)) {
+                            return;
+                        }
+
+                        loop_.unwatch(fd);
+                        it->second.open--;
+                        complete(pid);
+                    }) == PREP_ERROR) {
+                    continue;
+                }
+
+                running.open++;
+            }
+
+            loop_.watch_child(pid, [this](pid_t pid, int status) {
+                auto it = running_.find(pid);
+
+                if (it == running_.end()) {
+                    return;
+                }
+
+                it->second.exited = true;
+                it->second.status = status;
+                complete(pid);
+            });
+
+            return running.open == (child.error == -1 ? 1 : 2) ? PREP_SUCCESS : PREP_ERROR;
+        }
+
+        void Scheduler::complete(pid_t pid) {
+            auto it = running_.find(pid);
+
+            if (it == running_.end() || it->second.open > 0 || !it->second.exited) {
+                return;
+            }
+
+            auto running = it->second;
+
+            running_.erase(it);
+
+            running.done(running.job->finish(running.status));
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef MICRANTHA_PREP_SCHEDULER_H
+#define MICRANTHA_PREP_SCHEDULER_H
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include "event_loop.h"
+#include "package.h"
+#include "plugin.h"
+#include "task.h"
+
+namespace micrantha {
+    namespace prep {
+        /**
+         * runs plugin hooks side by side from a single thread, handing back
+         * the result of each hook as it finishes
+         */
+        class Scheduler {
+        public:
+            /**
+             * starts a hook on a plugin, returning nullptr if it could not be started
+             */
+            typedef std::function<std::shared_ptr<Plugin::Job>()> starter;
+
+            /**
+             * receives the result of a hook
+             */
+            typedef std::function<void(const Plugin::Result &result)> callback;
+
+            /**
+             * @param limit the most hooks to run at once, or zero for the number of processors
+             */
+            explicit Scheduler(size_t limit = 0);
+
+            /**
+             * the least number of hooks run at once by default
+             */
+            constexpr static const size_t MIN_LIMIT = 4;
+
+            /* kills any hooks left running */
+            ~Scheduler();
+
+            /* non-copyable */
+            Scheduler(const Scheduler &other) = delete;
+
+            Scheduler &operator=(const Scheduler &other) = delete;
+
+            /**
+             * queues a hook to start when there is room
+             * @param start starts the hook
+             * @param done called with the result of the hook, and may submit more hooks
+             */
+            void submit(const starter &start, const callback &done);
+
+#ifdef HAVE_COROUTINES
+            /**
+             * queues a hook to start when there is room
+             * @param start starts the hook
+             * @return an awaitable for the result of the hook
+             */
+            Callback<Plugin::Result> submit(const starter &start);
+#endif
+
+            /**
+             * runs hooks until every submitted hook has finished
+             * @return PREP_SUCCESS or PREP_ERROR if waiting on the hooks failed
+             */
+            int run();
+
+        private:
+            typedef struct Task {
+                starter start;
+                callback done;
+            } Task;
+
+            typedef struct Running {
+                std::shared_ptr<Plugin::Job> job;
+                callback done;
+                // the number of plugin descriptors still open
+                int open;
+                bool exited;
+                int status;
+            } Running;
+
+            /**
+             * starts queued hooks until the limit is reached
+             */
+            void start_pending();
+
+            /**
+             * watches the descriptors and exit of a running hook
+             * @return PREP_SUCCESS or PREP_ERROR if the hook could not be watched
+             */
+            int watch(pid_t pid);
+
+            /**
+             * finishes a hook once its output is closed and its process has exited
+             */
+            void complete(pid_t pid);
+
+            EventLoop loop_;
+            std::deque<Task> queue_;
+            std::map<pid_t, Running> running_;
+            size_t limit_;
+        };
+    }
+}
+
+#endif
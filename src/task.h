@@ -0,0 +1,157 @@
+#ifndef MICRANTHA_PREP_TASK_H
+#define MICRANTHA_PREP_TASK_H
+
+#ifdef HAVE_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+namespace micrantha {
+  namespace prep {
+
+    /**
+     * a coroutine producing a value.  a task starts running as soon as it is called and
+     * suspends at its first co_await, so several tasks can be started before awaiting any.
+     * a task must not be destroyed while it is suspended on something that will resume it.
+     */
+    template <class T>
+    class Task {
+     public:
+      struct promise_type {
+        std::optional<T> value;
+        // resumed when the task finishes
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept {
+          struct awaiter {
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+              auto continuation = handle.promise().continuation;
+
+              return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+          };
+          return awaiter{};
+        }
+
+        void return_value(T v) { value = std::move(v); }
+
+        // exceptions are not used for errors
+        void unhandled_exception() { std::terminate(); }
+      };
+
+      Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+      Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+          destroy();
+          handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+      }
+
+      /* non-copyable */
+      Task(const Task &other) = delete;
+
+      Task &operator=(const Task &other) = delete;
+
+      ~Task() { destroy(); }
+
+      /**
+       * @return true if the task has produced its value
+       */
+      bool done() const { return handle_ && handle_.done(); }
+
+      /**
+       * @return the value of a finished task
+       */
+      T &get() { return *handle_.promise().value; }
+
+      /**
+       * awaits the value of the task
+       */
+      auto operator co_await() noexcept {
+        struct awaiter {
+          std::coroutine_handle<promise_type> handle;
+
+          bool await_ready() const noexcept { return handle.done(); }
+
+          void await_suspend(std::coroutine_handle<> awaiting) noexcept { handle.promise().continuation = awaiting; }
+
+          T await_resume() { return std::move(*handle.promise().value); }
+        };
+        return awaiter{handle_};
+      }
+
+     private:
+      explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+      void destroy() {
+        if (handle_) {
+          handle_.destroy();
+          handle_ = nullptr;
+        }
+      }
+
+      std::coroutine_handle<promise_type> handle_;
+    };
+
+    /**
+     * awaits an operation that reports its result to a callback
+     */
+    template <class T>
+    class Callback {
+     public:
+      typedef std::function<void(const T &value)> callback;
+
+      // begins the operation, which calls back once it has a result
+      typedef std::function<void(const callback &done)> starter;
+
+      explicit Callback(starter start) : start_(std::move(start)), suspended_(false) {}
+
+      bool await_ready() const noexcept { return false; }
+
+      bool await_suspend(std::coroutine_handle<> awaiting) {
+        awaiting_ = awaiting;
+
+        start_([this](const T &value) {
+          value_ = value;
+
+          if (suspended_) {
+            awaiting_.resume();
+          }
+        });
+
+        // the operation finished right away, carry on without suspending
+        if (value_) {
+          return false;
+        }
+
+        suspended_ = true;
+        return true;
+      }
+
+      T await_resume() { return std::move(*value_); }
+
+     private:
+      starter start_;
+      std::optional<T> value_;
+      std::coroutine_handle<> awaiting_;
+      bool suspended_;
+    };
+  }
+}
+
+#endif
+
+#endif
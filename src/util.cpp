@@ -1,19 +1,61 @@
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
-#include <fts.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <deque>
 #include <limits.h>
+#include <spawn.h>
 #include <sys/wait.h>
+#include <termios.h>
+#include <atomic>
+#include <condition_variable>
+#include <dirent.h>
+#include <memory>
+#include <mutex>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef __APPLE__
+#include <pty.h>
+#else
+#include <util.h>
+#endif
+
+// posix_spawn can set the working directory of the child
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define HAVE_POSIX_SPAWN_CHDIR
+#endif
+
+// and close the descriptors it would inherit
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+#define HAVE_POSIX_SPAWN_CLOSEFROM
+#endif
+
+extern char **environ;
 
 #include "common.h"
 #include "log.h"
+#include "walk.h"
 
 namespace micrantha {
   namespace prep {
@@ -23,6 +65,21 @@ namespace micrantha {
       bool equals(const std::string &left, const std::string &right) {
         return !strcasecmp(left.c_str(), right.c_str());
       }
+
+      std::string hash(const std::string &value) {
+        uint64_t h = 14695981039346656037ULL;
+
+        for (auto ch : value) {
+          h ^= static_cast<unsigned char>(ch);
+          h *= 1099511628211ULL;
+        }
+
+        char buf[17] = {0};
+
+        snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+
+        return buf;
+      }
     }
     namespace io {
       ssize_t write(int fd, const std::string &line) {
@@ -31,19 +88,104 @@ namespace micrantha {
 
       // writes a line to a file descriptor
       ssize_t write_line(int fd, const std::string &line) {
-        ssize_t n1 = ::write(fd, line.c_str(), line.length());
+        struct iovec iov[] = {{const_cast<char *>(line.c_str()), line.length()},
+                              {const_cast<char *>("\n"), 1}};
+
+        return ::writev(fd, iov, 2);
+      }
+
+      LineWriter::LineWriter(int fd, size_t limit, std::chrono::milliseconds latency)
+          : fd_(fd), limit_(limit), latency_(latency), size_(0) {}
+
+      LineWriter::~LineWriter() {
+        flush();
+      }
 
-        if (n1 < 0) {
-          return n1;
+      ssize_t LineWriter::write_line(std::string_view line) {
+        return write_line(std::string_view(), line);
+      }
+
+      ssize_t LineWriter::write_line(std::string_view prefix, std::string_view line) {
+        if (pending_.empty()) {
+          since_ = std::chrono::steady_clock::now();
         }
 
-        auto n2 = ::write(fd, "\n", 1);
+        auto length = prefix.length() + line.length() + 1;
 
-        if (n2 < 0) {
-          return n2;
+        pending_.emplace_back();
+        pending_.back().reserve(length);
+        pending_.back().append(prefix).append(line) += '\n';
+        size_ += length;
+
+        if (size_ >= limit_ || due() == 0) {
+          if (flush() < 0) {
+            return -1;
+          }
         }
 
-        return n1 + n2;
+        return length;
+      }
+
+      ssize_t LineWriter::flush() {
+        if (pending_.empty()) {
+          return 0;
+        }
+
+        std::vector<struct iovec> iov;
+        ssize_t total = 0;
+        size_t index = 0;
+
+        iov.reserve(pending_.size());
+
+        for (auto &line : pending_) {
+          iov.push_back({const_cast<char *>(line.data()), line.size()});
+        }
+
+        while (index < iov.size()) {
+          auto count = std::min<size_t>(iov.size() - index, IOV_MAX);
+
+          ssize_t n = ::writev(fd_, &iov[index], count);
+
+          if (n < 0) {
+            if (errno == EINTR) {
+              continue;
+            }
+            total = -1;
+            break;
+          }
+
+          total += n;
+
+          // skip past what was written, which may end part way into a line
+          while (n > 0) {
+            if (static_cast<size_t>(n) >= iov[index].iov_len) {
+              n -= iov[index++].iov_len;
+            } else {
+              iov[index].iov_base = static_cast<char *>(iov[index].iov_base) + n;
+              iov[index].iov_len -= n;
+              n = 0;
+            }
+          }
+        }
+
+        pending_.clear();
+        size_ = 0;
+
+        return total;
+      }
+
+      long LineWriter::due() const {
+        if (pending_.empty()) {
+          return -1;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since_);
+
+        return std::max<long>(0, (latency_ - elapsed).count());
+      }
+
+      bool LineWriter::empty() const {
+        return pending_.empty();
       }
 
       // reads a line from a file descriptor
@@ -84,6 +226,143 @@ namespace micrantha {
         return totRead;
       }
 
+      int temporary_file(const char *name) {
+        int fd = -1;
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+        fd = static_cast<int>(syscall(SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING));
+#endif
+
+        if (fd < 0) {
+          // no memfd, use a file that is gone once closed
+          char path[PATH_MAX] = {0};
+
+          auto tmpdir = getenv("TMPDIR");
+
+          snprintf(path, sizeof(path), "%s/%s-XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp", name);
+
+          fd = mkstemp(path);
+
+          if (fd < 0) {
+            return -1;
+          }
+
+          unlink(path);
+        }
+
+        // keep clear of the descriptor it will be given as, so passing it on never clashes
+        int moved = fcntl(fd, F_DUPFD_CLOEXEC, process::RequestFileno + 1);
+
+        ::close(fd);
+
+        return moved;
+      }
+
+      int seal_file(int fd) {
+#if defined(__linux__) && defined(F_ADD_SEALS)
+        // a memfd can not be changed once sealed, a fallback file is left as it is
+        if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0 && errno != EINVAL &&
+            errno != EPERM) {
+          return PREP_ERROR;
+        }
+#endif
+
+        if (lseek(fd, 0, SEEK_SET) < 0) {
+          return PREP_ERROR;
+        }
+
+        return PREP_SUCCESS;
+      }
+
+      LineReader::LineReader(int fd, size_t capacity) : fd_(fd), buf_(capacity), begin_(0), end_(0), eof_(false) {}
+
+      ssize_t LineReader::fill() {
+        // carry the partial line over to the front of the buffer
+        if (begin_ > 0) {
+          memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+          end_ -= begin_;
+          begin_ = 0;
+        }
+
+        // a line longer than the buffer
+        if (end_ == buf_.size()) {
+          buf_.resize(buf_.size() * 2);
+        }
+
+        for (;;) {
+          ssize_t n = ::read(fd_, buf_.data() + end_, buf_.size() - end_);
+
+          if (n == -1) {
+            if (errno == EINTR) { /* Interrupted --> restart read() */
+              continue;
+            }
+            // a terminal reports EIO once the other side has closed
+            if (errno == EIO) {
+              eof_ = true;
+              return 0;
+            }
+            return -1;
+          }
+
+          if (n == 0) {
+            eof_ = true;
+          }
+
+          end_ += n;
+
+          return n;
+        }
+      }
+
+      bool LineReader::next(std::string &line) {
+        if (begin_ == end_) {
+          return false;
+        }
+
+        const char *start = buf_.data() + begin_;
+        size_t length = end_ - begin_;
+
+        // memchr is vectorized by the c library
+        auto newline = static_cast<const char *>(memchr(start, '\n', length));
+
+        if (newline != nullptr) {
+          length = newline - start;
+          begin_ += length + 1;
+        } else if (eof_) {
+          begin_ = end_;
+        } else {
+          return false;
+        }
+
+        line.assign(start, length);
+
+        if (memchr(start, '\r', length) != nullptr) {
+          line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+        }
+
+        return true;
+      }
+
+      bool LineReader::next(size_t count, std::string &block) {
+        if (end_ - begin_ < count) {
+          return false;
+        }
+
+        block.assign(buf_.data() + begin_, count);
+
+        begin_ += count;
+
+        return true;
+      }
+
+      bool LineReader::eof() const {
+        return eof_;
+      }
+
+      int LineReader::fd() const {
+        return fd_;
+      }
+
       // utility for variadic print
       std::ostream &print(std::ostream &os) {
         return os;
@@ -96,6 +375,216 @@ namespace micrantha {
 
 
     namespace process {
+      void close(Child &child) {
+        // a terminal uses the same descriptor both ways
+        if (child.input != -1 && child.input != child.output) {
+          ::close(child.input);
+        }
+        if (child.output != -1) {
+          ::close(child.output);
+        }
+        if (child.error != -1) {
+          ::close(child.error);
+        }
+        child.input = child.output = child.error = -1;
+      }
+
+      namespace internal {
+        // creates a pipe that is closed on exec
+        int make_pipe(int fds[2]) {
+#ifdef __linux__
+          return pipe2(fds, O_CLOEXEC);
+#else
+          if (pipe(fds)) {
+            return -1;
+          }
+          fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+          fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+          return 0;
+#endif
+        }
+
+        // replaces a forked child with a command
+        void exec_child(const std::string &command, char *const argv[], const char *directory,
+                        char *const envp[]) {
+          if (directory != nullptr && chdir(directory)) {
+            log::perror("unable to change directory ", directory);
+            _exit(EXIT_FAILURE);
+          }
+
+          execve(command.c_str(), argv, envp);
+
+          _exit(EXIT_FAILURE);  // exec never returns
+        }
+
+#ifdef HAVE_POSIX_SPAWN_CHDIR
+        /**
+         * starts a command in a new session without copying the address space of this process.
+         * each pair of descriptors is duplicated onto the child, the rest are closed on exec.
+         */
+        pid_t spawn(const std::string &command, char *const argv[], const char *directory, char *const envp[],
+                    std::vector<std::pair<int, int>> fds, const char *terminal, int request) {
+          posix_spawn_file_actions_t actions;
+          posix_spawnattr_t attr;
+          pid_t pid = -1;
+
+          posix_spawn_file_actions_init(&actions);
+          posix_spawnattr_init(&attr);
+
+          // a session leader opening a terminal takes it as its controlling terminal
+          posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+
+          if (terminal != nullptr) {
+            posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, terminal, O_RDWR, 0);
+          }
+
+          // last, so a pipe that happens to be the request descriptor is duplicated before it is replaced
+          if (request != -1) {
+            fds.emplace_back(request, process::RequestFileno);
+          }
+
+          for (const auto &fd : fds) {
+            posix_spawn_file_actions_adddup2(&actions, fd.first, fd.second);
+          }
+
+          if (directory != nullptr) {
+            posix_spawn_file_actions_addchdir_np(&actions, directory);
+          }
+
+          errno = posix_spawn(&pid, command.c_str(), &actions, &attr, argv, envp);
+
+          posix_spawnattr_destroy(&attr);
+          posix_spawn_file_actions_destroy(&actions);
+
+          return errno ? -1 : pid;
+        }
+#endif
+      }
+
+      int spawn_pipes(const std::string &command, char *const argv[], const char *directory, char *const envp[],
+                      Child &child, int request) {
+        int in[2] = {-1, -1}, out[2] = {-1, -1}, err[2] = {-1, -1};
+
+        if (internal::make_pipe(in) || internal::make_pipe(out) || internal::make_pipe(err)) {
+          log::perror("pipe");
+          for (auto fd : {in[0], in[1], out[0], out[1], err[0], err[1]}) {
+            if (fd != -1) {
+              ::close(fd);
+            }
+          }
+          return PREP_ERROR;
+        }
+
+#ifdef HAVE_POSIX_SPAWN_CHDIR
+        pid_t pid = internal::spawn(command, argv, directory, envp,
+                                    {{in[0], STDIN_FILENO}, {out[1], STDOUT_FILENO}, {err[1], STDERR_FILENO}},
+                                    nullptr, request);
+#else
+        pid_t pid = fork();
+
+        if (pid == 0) {
+          // a session of its own, like a terminal would give it
+          setsid();
+
+          if (dup2(in[0], STDIN_FILENO) < 0 || dup2(out[1], STDOUT_FILENO) < 0 ||
+              dup2(err[1], STDERR_FILENO) < 0 || (request != -1 && dup2(request, RequestFileno) < 0)) {
+            _exit(EXIT_FAILURE);
+          }
+
+          internal::exec_child(command, argv, directory, envp);
+        }
+#endif
+
+        ::close(in[0]);
+        ::close(out[1]);
+        ::close(err[1]);
+
+        if (pid < 0) {
+          log::perror("spawn ", command);
+          ::close(in[1]);
+          ::close(out[0]);
+          ::close(err[0]);
+          return PREP_ERROR;
+        }
+
+        child.pid = pid;
+        child.input = in[1];
+        child.output = out[0];
+        child.error = err[0];
+        child.terminal = false;
+
+        return PREP_SUCCESS;
+      }
+
+      int spawn_terminal(const std::string &command, char *const argv[], const char *directory,
+                         char *const envp[], Child &child, int request) {
+        struct termios tios = {};
+
+#ifdef HAVE_POSIX_SPAWN_CHDIR
+        int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+        if (master < 0 || grantpt(master) || unlockpt(master)) {
+          log::perror("posix_openpt");
+          if (master >= 0) {
+            ::close(master);
+          }
+          return PREP_ERROR;
+        }
+
+        char terminal[PATH_MAX] = {0};
+
+        if (ptsname_r(master, terminal, sizeof(terminal))) {
+          log::perror("ptsname");
+          ::close(master);
+          return PREP_ERROR;
+        }
+
+        // set some terminal flags to remove local echo before the child can write
+        tcgetattr(master, &tios);
+        tios.c_lflag &= ~(ECHO | ECHONL | ECHOCTL);
+        tcsetattr(master, TCSAFLUSH, &tios);
+
+        pid_t pid = internal::spawn(command, argv, directory, envp,
+                                    {{STDIN_FILENO, STDOUT_FILENO}, {STDIN_FILENO, STDERR_FILENO}}, terminal, request);
+
+        if (pid < 0) {
+          log::perror("spawn ", command);
+          ::close(master);
+          return PREP_ERROR;
+        }
+#else
+        int master = -1;
+
+        // fork a psuedo terminal
+        pid_t pid = forkpty(&master, nullptr, nullptr, nullptr);
+
+        if (pid < 0) {
+          log::perror("forkpty");
+          return PREP_ERROR;
+        }
+
+        if (pid == 0) {
+          if (request != -1 && dup2(request, RequestFileno) < 0) {
+            _exit(EXIT_FAILURE);
+          }
+
+          internal::exec_child(command, argv, directory, envp);
+        }
+
+        // set some terminal flags to remove local echo
+        tcgetattr(master, &tios);
+        tios.c_lflag &= ~(ECHO | ECHONL | ECHOCTL);
+        tcsetattr(master, TCSAFLUSH, &tios);
+#endif
+
+        child.pid = pid;
+        child.input = child.output = master;
+        child.error = -1;
+        child.terminal = true;
+
+        return PREP_SUCCESS;
+      }
+
       int fork_command(const std::string &command, char *const argv[], const char *directory, char *const envp[]) {
         int rval = EXIT_FAILURE;
 
@@ -151,82 +640,336 @@ namespace micrantha {
 
     namespace filesystem {
 
+      namespace internal {
+        // the most threads removing a tree
+        constexpr static const size_t MAX_REMOVE_THREADS = 8;
+
+        // the most threads adding up the size of a tree
+        constexpr static const size_t MAX_USAGE_THREADS = 8;
+
+        // ends the name of a folder in the trash, made unique by mkdtemp
+        constexpr static const char *const TRASH_SUFFIX = ".XXXXXX";
+
+        /**
+         * what has been seen of paths this run, as a mode or an errno
+         */
+        class StatCache {
+         public:
+          StatCache() : hits_(0), misses_(0) {}
+
+          int get(const path &path, mode_t &mode) {
+            {
+              std::lock_guard<std::mutex> lock(mutex_);
+
+              auto it = seen_.find(path);
+
+              if (it != seen_.end()) {
+                hits_++;
+                mode = it->second.mode;
+                return it->second.error;
+              }
+
+              misses_++;
+            }
+
+            struct stat st = {};
+
+            Seen seen = {0, 0};
+
+            if (stat(path.c_str(), &st) == -1) {
+              seen.error = errno;
+            } else {
+              seen.mode = st.st_mode;
+            }
+
+            // only a found or missing path is worth remembering
+            if (seen.error == 0 || seen.error == ENOENT || seen.error == ENOTDIR) {
+              std::lock_guard<std::mutex> lock(mutex_);
+
+              seen_[path] = seen;
+            }
+
+            mode = seen.mode;
+
+            return seen.error;
+          }
+
+          void forget(const path &path) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            for (auto it = seen_.begin(); it != seen_.end();) {
+              if (it->first.compare(0, path.size(), path) == 0 &&
+                  (it->first.size() == path.size() || it->first[path.size()] == '/')) {
+                it = seen_.erase(it);
+              } else {
+                ++it;
+              }
+            }
+          }
+
+          void clear() {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            seen_.clear();
+          }
+
+          StatCounts counts() {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            return {hits_, misses_};
+          }
+
+         private:
+          typedef struct {
+            mode_t mode;
+            int error;
+          } Seen;
+
+          std::mutex mutex_;
+          std::unordered_map<std::string, Seen> seen_;
+          size_t hits_;
+          size_t misses_;
+        };
+
+        StatCache stat_cache;
+      }  // namespace internal
+
+      int stat_cached(const path &path, mode_t &mode) {
+        return internal::stat_cache.get(path, mode);
+      }
+
+      void invalidate(const path &path) {
+        // a trailing separator would miss what is under it
+        auto end = path.find_last_not_of('/');
+
+        internal::stat_cache.forget(end == std::string::npos ? path : path.substr(0, end + 1));
+      }
+
+      void invalidate() {
+        internal::stat_cache.clear();
+      }
+
+      StatCounts stat_counts() {
+        return internal::stat_cache.counts();
+      }
+
       int remove_directory(const path &dir) {
-        int ret = PREP_SUCCESS;
-        FTS *ftsp = nullptr;
-        FTSENT *curr = nullptr;
-
-        // Cast needed (in C) because fts_open() takes a "char * const *", instead
-        // of a "const char * const *", which is only allowed in C++. fts_open()
-        // does not modify the argument.
-        char *files[] = {const_cast<char *>(dir.c_str()), nullptr};
-
-        // FTS_NOCHDIR  - Avoid changing cwd, which could cause unexpected behavior
-        //                in multithreaded programs
-        // FTS_PHYSICAL - Don't follow symlinks. Prevents deletion of files outside
-        //                of the specified directory
-        // FTS_XDEV     - Don't cross filesystem boundaries
-        ftsp = fts_open(files, FTS_NOCHDIR | FTS_PHYSICAL | FTS_XDEV, nullptr);
-
-        if (!ftsp) {
-          log::perror("failed to open ", dir);
+        struct stat st = {};
+
+        if (lstat(dir.c_str(), &st) == -1) {
+          log::perror(dir, ": Failed to remove");
           return PREP_FAILURE;
         }
 
-        while ((curr = fts_read(ftsp))) {
-          switch (curr->fts_info) {
-            case FTS_NS:
-            case FTS_DNR:
-            case FTS_ERR:
-              log::error(curr->fts_accpath, ": ", strerror(curr->fts_errno));
-              break;
+        // a link or a file is just removed, links are not followed
+        if (!S_ISDIR(st.st_mode)) {
+          if (unlink(dir.c_str()) == -1) {
+            log::perror(dir, ": Failed to remove");
+            return PREP_FAILURE;
+          }
+          invalidate(dir);
+          return PREP_SUCCESS;
+        }
 
-            case FTS_DC:
-            case FTS_DOT:
-            case FTS_NSOK:
-              // Not reached unless FTS_LOGICAL, FTS_SEEDOT, or FTS_NOSTAT were
-              // passed to fts_open()
-              break;
+        std::mutex mutex;
+        std::string failed;
+        int error = 0;
 
-            case FTS_D:
-              // Do nothing. Need depth-first search, so directories are deleted
-              // in FTS_DP
-              break;
+        // remembers the first thing that could not be removed
+        auto fail = [&mutex, &failed, &error](const walk::Entry &entry, int why) {
+          std::lock_guard<std::mutex> lock(mutex);
 
-            case FTS_DP:
-            case FTS_F:
-            case FTS_SL:
-            case FTS_SLNONE:
-            case FTS_DEFAULT:
-              if (remove(curr->fts_accpath) < 0) {
-                log::perror(curr->fts_path, ": Failed to remove");
-                ret = PREP_FAILURE;
-              }
-              break;
-            default:
-              break;
+          if (error == 0) {
+            failed = entry.depth == 0 ? entry.name : entry.path();
+            error = why;
+          }
+        };
+
+        walk::Options options;
+
+        options.threads = internal::MAX_REMOVE_THREADS;
+        options.same_device = true;
+        options.error = fail;
+
+        options.file = [&fail](const walk::Entry &entry) {
+          if (unlinkat(entry.dirfd, entry.name, 0) == -1 && errno != ENOENT) {
+            fail(entry, errno);
+          }
+          return walk::NEXT;
+        };
+
+        // everything in the folder is gone by now
+        options.leave = [&fail](const walk::Entry &entry) {
+          if (unlinkat(entry.dirfd, entry.name, AT_REMOVEDIR) == -1) {
+            fail(entry, errno);
           }
+          return walk::NEXT;
+        };
+
+        walk::tree(dir, options);
+
+        invalidate(dir);
+
+        if (error != 0) {
+          log::perror(failed, ": Failed to remove (", strerror(error), ")");
+          return PREP_FAILURE;
         }
 
-        fts_close(ftsp);
+        return PREP_SUCCESS;
+      }
+
+      int move_to_trash(const path &dir, const path &trash) {
+        auto name = dir.substr(dir.rfind('/') + 1);
+
+        // an empty folder with a unique name, which the folder then replaces
+        auto temp = build_path(trash, name) + internal::TRASH_SUFFIX;
+
+        if (mkdtemp(&temp[0]) == nullptr) {
+          return PREP_FAILURE;
+        }
+
+        if (rename(dir.c_str(), temp.c_str()) == -1) {
+          int error = errno;
+          rmdir(temp.c_str());
+          errno = error;
+          return PREP_FAILURE;
+        }
 
-        return ret;
+        invalidate(dir);
+
+        return PREP_SUCCESS;
+      }
+
+      int empty_trash(const path &trash) {
+        if (directory_empty(trash) != PREP_FAILURE) {
+          return PREP_SUCCESS;
+        }
+
+#ifdef __linux__
+        // a new process, rather than a fork of this one and its threads, locks and descriptors
+        const char *exe = "/proc/self/exe";
+
+        int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+        if (null == -1) {
+          return PREP_FAILURE;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        pid_t pid = -1;
+
+        posix_spawn_file_actions_init(&actions);
+        posix_spawnattr_init(&attr);
+
+        // a session of its own, so it outlives the caller and its terminal
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+
+        for (auto fd : {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO}) {
+          posix_spawn_file_actions_adddup2(&actions, null, fd);
+        }
+
+#ifdef HAVE_POSIX_SPAWN_CLOSEFROM
+        // plugin pipes and terminals that are not closed on exec would be held open
+        posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+
+        char *const argv[] = {const_cast<char *>("prep"), nullptr};
+
+        // the folder is handed over in the environment, so it is not a command anyone can type
+        std::vector<std::string> env = {std::string(TRASH_VARIABLE) + "=" + trash};
+        std::vector<char *> envp;
+
+        for (char **value = environ; *value != nullptr; value++) {
+          if (strncmp(*value, TRASH_VARIABLE, strlen(TRASH_VARIABLE)) != 0 ||
+              (*value)[strlen(TRASH_VARIABLE)] != '=') {
+            envp.push_back(*value);
+          }
+        }
+
+        envp.push_back(const_cast<char *>(env.front().c_str()));
+        envp.push_back(nullptr);
+
+        // not waited for, it is left to init when this process exits
+        errno = posix_spawn(&pid, exe, &actions, &attr, argv, envp.data());
+
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+
+        close(null);
+
+        return errno ? PREP_FAILURE : PREP_SUCCESS;
+#else
+        return remove_trash(trash);
+#endif
+      }
+
+      void close_inherited() {
+#if !defined(HAVE_POSIX_SPAWN_CLOSEFROM) && defined(__linux__) && defined(SYS_close_range)
+        // the descriptors could not be closed when this process was started
+        syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 0);
+#endif
+      }
+
+      int remove_trash(const path &trash) {
+        // stay out of the way of whatever the user does next
+        setpriority(PRIO_PROCESS, 0, 10);
+
+        int fd = open(trash.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd == -1) {
+          return errno == ENOENT ? PREP_SUCCESS : PREP_FAILURE;
+        }
+
+        // another process is already emptying it
+        if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+          close(fd);
+          return PREP_SUCCESS;
+        }
+
+        int rval = PREP_SUCCESS;
+
+        // until nothing more is moved in
+        while (rval == PREP_SUCCESS && directory_empty(trash) == PREP_FAILURE) {
+          DIR *dir = opendir(trash.c_str());
+
+          if (dir == nullptr) {
+            rval = PREP_FAILURE;
+            break;
+          }
+
+          struct dirent *entry = nullptr;
+
+          while ((entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 &&
+                remove_directory(build_path(trash, entry->d_name)) != PREP_SUCCESS) {
+              // what is left can not be removed, leave it
+              rval = PREP_FAILURE;
+            }
+          }
+
+          closedir(dir);
+        }
+
+        close(fd);
+
+        return rval;
       }
 
       int directory_exists(const path &path) {
-        struct stat s{
-        };
-        int err = stat(path.c_str(), &s);
-        if (-1 == err) {
-          if (ENOENT == errno) {
+        mode_t mode = 0;
+        int err = stat_cached(path, mode);
+        if (0 != err) {
+          if (ENOENT == err) {
             /* does not exist */
             return PREP_ERROR;
           } else {
+            errno = err;
             log::perror(path);
             exit(1);
           }
         } else {
-          if (S_ISDIR(s.st_mode)) {
+          if (S_ISDIR(mode)) {
             /* it's a dir */
             return PREP_SUCCESS;
           } else {
@@ -236,60 +979,55 @@ namespace micrantha {
       }
 
       int directory_empty(const path &path) {
-        FTS *ftsp = nullptr;
-        FTSENT *curr = nullptr;
-
-        // Cast needed (in C) because fts_open() takes a "char * const *", instead
-        // of a "const char * const *", which is only allowed in C++. fts_open()
-        // does not modify the argument.
-        char *files[] = {const_cast<char *>(path.c_str()), nullptr};
-
-        // FTS_NOCHDIR  - Avoid changing cwd, which could cause unexpected behavior
-        //                in multithreaded programs
-        // FTS_PHYSICAL - Don't follow symlinks. Prevents deletion of files outside
-        //                of the specified directory
-        // FTS_XDEV     - Don't cross filesystem boundaries
-        ftsp = fts_open(files, FTS_NOCHDIR | FTS_COMFOLLOW, nullptr);
-
-        if (!ftsp) {
-          log::perror("failed to open ", path);
-          return PREP_ERROR;
-        }
+        walk::Options options;
 
-        while ((curr = fts_read(ftsp))) {
-          switch (curr->fts_info) {
-            case FTS_NS:
-            case FTS_DNR:
-            case FTS_ERR:
-              log::error(curr->fts_accpath, ": ", strerror(curr->fts_errno));
-              fts_close(ftsp);
-              return PREP_ERROR;
+        options.follow_root = true;
 
-            case FTS_DC:
-            case FTS_DOT:
-            case FTS_NSOK:
-              // Not reached unless FTS_LOGICAL, FTS_SEEDOT, or FTS_NOSTAT were
-              // passed to fts_open()
-              break;
+        // anything in the folder ends the walk
+        options.enter = [](const walk::Entry &entry) { return entry.depth == 0 ? walk::NEXT : walk::STOP; };
+        options.file = [](const walk::Entry &) { return walk::STOP; };
 
-            case FTS_D:
-              // Do nothing. Need depth-first search, so directories are deleted
-              // in FTS_DP
-              break;
+        options.error = [](const walk::Entry &entry, int error) {
+          log::error(entry.depth == 0 ? entry.name : entry.path(), ": ", strerror(error));
+        };
 
-            case FTS_DP:
-            case FTS_F:
-            case FTS_SL:
-            case FTS_SLNONE:
-            case FTS_DEFAULT:
-              fts_close(ftsp);
-              return PREP_FAILURE;
-            default:
-              break;
+        return walk::tree(path, options);
+      }
+
+      int disk_usage(const path &path, uint64_t &bytes) {
+        std::atomic<uint64_t> total(0);
+
+        auto add = [&total](const walk::Entry &entry) {
+          struct stat st = {};
+
+          if (fstatat(entry.dirfd, entry.name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            total += static_cast<uint64_t>(st.st_blocks) * 512;
           }
+          return walk::NEXT;
+        };
+
+        walk::Options options;
+
+        options.threads = internal::MAX_USAGE_THREADS;
+        options.same_device = true;
+        options.enter = add;
+        options.file = add;
+
+        int rval = walk::tree(path, options);
+
+        bytes = total;
+
+        return rval == PREP_SUCCESS ? PREP_SUCCESS : PREP_FAILURE;
+      }
+
+      int free_space(const path &path, uint64_t &bytes) {
+        struct statvfs st = {};
+
+        if (statvfs(path.c_str(), &st) == -1) {
+          return PREP_FAILURE;
         }
 
-        fts_close(ftsp);
+        bytes = static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
 
         return PREP_SUCCESS;
       }
@@ -350,6 +1088,9 @@ namespace micrantha {
               *p = '/';
               return PREP_ERROR;
             }
+          } else {
+            // everything under the new folder was missing until now
+            invalidate(file_path);
           }
           *p = '/';
         }
@@ -357,53 +1098,316 @@ namespace micrantha {
           if (errno != EEXIST) {
             return PREP_ERROR;
           }
+        } else {
+          invalidate(path);
         }
         return PREP_SUCCESS;
       }
 
+      namespace internal {
+        // trees with fewer files than this are copied without starting workers
+        constexpr static const size_t PARALLEL_COPY_FILES = 64;
+
+        // the most workers copying a tree, storage stops keeping up well before cores run out
+        constexpr static const size_t MAX_COPY_WORKERS = 8;
+
+        // the buffer used when the kernel can not copy
+        constexpr static const size_t COPY_BUFFER_SIZE = 128 * 1024;
+
+        // errors meaning a way of copying does not work for these files, so the next should be tried
+        bool unsupported(int error) {
+          return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == ENOTSUP;
+        }
+
+        /**
+         * copies part of a file to the same offset in another, with the fastest way the kernel allows
+         * @return PREP_SUCCESS or PREP_ERROR with errno set
+         */
+        int copy_range(int src, int dst, off_t offset, off_t end) {
+#if defined(__linux__) && defined(SYS_copy_file_range)
+          // copied in the kernel, and shared if the file system can
+          while (offset < end) {
+            loff_t in = offset, out = offset;
+
+            auto n = syscall(SYS_copy_file_range, src, &in, dst, &out, static_cast<size_t>(end - offset), 0);
+
+            if (n > 0) {
+              offset += n;
+            } else if (n == 0) {
+              // the file got shorter
+              return PREP_SUCCESS;
+            } else if (errno != EINTR) {
+              if (!unsupported(errno)) {
+                return PREP_ERROR;
+              }
+              break;
+            }
+          }
+#endif
+
+#ifdef __linux__
+          // older kernels and different file systems, still copied in the kernel
+          if (offset < end && lseek(dst, offset, SEEK_SET) == -1) {
+            return PREP_ERROR;
+          }
+
+          while (offset < end) {
+            off_t in = offset;
+
+            auto n = sendfile(dst, src, &in, static_cast<size_t>(end - offset));
+
+            if (n > 0) {
+              offset += n;
+            } else if (n == 0) {
+              return PREP_SUCCESS;
+            } else if (errno != EINTR) {
+              if (!unsupported(errno)) {
+                return PREP_ERROR;
+              }
+              break;
+            }
+          }
+#endif
+
+          if (offset >= end) {
+            return PREP_SUCCESS;
+          }
+
+          std::vector<char> buf(COPY_BUFFER_SIZE);
+
+          while (offset < end) {
+            auto n = pread(src, buf.data(), std::min<off_t>(buf.size(), end - offset), offset);
+
+            if (n == 0) {
+              return PREP_SUCCESS;
+            }
+
+            if (n == -1) {
+              if (errno == EINTR) {
+                continue;
+              }
+              return PREP_ERROR;
+            }
+
+            for (ssize_t written = 0; written < n;) {
+              auto w = pwrite(dst, buf.data() + written, n - written, offset + written);
+
+              if (w == -1) {
+                if (errno == EINTR) {
+                  continue;
+                }
+                return PREP_ERROR;
+              }
+
+              written += w;
+            }
+
+            offset += n;
+          }
+
+          return PREP_SUCCESS;
+        }
+
+        /**
+         * copies the contents of one file to another of the same size, leaving holes in a sparse file as holes
+         * @return PREP_SUCCESS or PREP_ERROR with errno set
+         */
+        int copy_data(int src, int dst, const struct stat &st) {
+          off_t size = st.st_size;
+
+#ifdef SEEK_DATA
+          // fewer blocks than the size means there are holes, only the data between them is copied
+          if (static_cast<off_t>(st.st_blocks) * 512 < size) {
+            off_t offset = 0;
+
+            while (offset < size) {
+              off_t data = lseek(src, offset, SEEK_DATA);
+
+              if (data == -1) {
+                // nothing but a hole left
+                if (errno == ENXIO) {
+                  return PREP_SUCCESS;
+                }
+                // the kernel can not find holes, copy everything
+                if (offset == 0 && errno == EINVAL) {
+                  break;
+                }
+                return PREP_ERROR;
+              }
+
+              off_t hole = lseek(src, data, SEEK_HOLE);
+
+              if (hole == -1) {
+                return PREP_ERROR;
+              }
+
+              if (copy_range(src, dst, data, std::min(hole, size)) != PREP_SUCCESS) {
+                return PREP_ERROR;
+              }
+
+              offset = hole;
+            }
+
+            // otherwise holes could not be found
+            if (offset > 0) {
+              return PREP_SUCCESS;
+            }
+          }
+#endif
+
+          return copy_range(src, dst, 0, size);
+        }
+
+        /**
+         * copies files, spread over workers when there are many
+         * @param files pairs of files to copy from and to
+         * @return PREP_SUCCESS or PREP_FAILURE if a file could not be copied
+         */
+        int copy_files(const std::vector<std::pair<std::string, std::string>> &files) {
+          std::atomic_size_t next(0);
+          // the first file that could not be copied, and why
+          std::atomic_size_t failure(files.size());
+          int error = 0;
+
+          auto worker = [&files, &next, &failure, &error]() {
+            for (size_t i = next++; i < files.size() && failure == files.size(); i = next++) {
+              if (copy_file(files[i].first, files[i].second) == PREP_SUCCESS) {
+                continue;
+              }
+
+              int copy_error = errno;
+              size_t none = files.size();
+
+              if (failure.compare_exchange_strong(none, i)) {
+                error = copy_error;
+              }
+            }
+          };
+
+          std::vector<std::thread> workers;
+
+          if (files.size() >= PARALLEL_COPY_FILES) {
+            size_t count = std::min<size_t>(MAX_COPY_WORKERS, std::thread::hardware_concurrency());
+
+            // this thread is a worker too
+            for (size_t i = 1; i < count; i++) {
+              try {
+                workers.emplace_back(worker);
+              } catch (const std::system_error &) {
+                // out of threads, the ones started will do
+                break;
+              }
+            }
+          }
+
+          worker();
+
+          for (auto &thread : workers) {
+            thread.join();
+          }
+
+          if (failure < files.size()) {
+            log::perror("unable to copy [", files[failure].first, "] (", strerror(error), ")");
+            return PREP_FAILURE;
+          }
+
+          return PREP_SUCCESS;
+        }
+      }  // namespace internal
+
       int copy_file(const path &from, const path &to) {
-        struct stat fst = {}, tst = {};
+        struct stat st = {};
 
-        if (stat(from.c_str(), &fst)) {
-          log::perror(errno);
+        int src = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (src == -1) {
           return PREP_FAILURE;
         }
 
-        std::ifstream src(from, std::ios::binary);
-
-        if (!src.is_open()) {
+        if (fstat(src, &st) == -1) {
+          close(src);
           return PREP_FAILURE;
         }
 
-        std::ofstream dst(to, std::ios::binary);
+        int dst = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
 
-        if (!dst.is_open()) {
+        if (dst == -1) {
+          close(src);
           return PREP_FAILURE;
         }
 
-        dst << src.rdbuf();
+        bool copied = false;
 
-        src.close();
-        dst.close();
+#ifdef FICLONE
+        // file systems that can share the data have nothing to copy
+        copied = ioctl(dst, FICLONE, src) == 0;
+#endif
 
-        if (stat(to.c_str(), &tst)) {
-          log::perror(errno);
+        int rval = PREP_SUCCESS;
+
+        if (!copied && (ftruncate(dst, st.st_size) == -1 || internal::copy_data(src, dst, st) != PREP_SUCCESS)) {
+          rval = PREP_FAILURE;
+        }
+
+        if (rval == PREP_SUCCESS && fchmod(dst, st.st_mode & 07777) == -1) {
+          rval = PREP_FAILURE;
+        }
+
+        int error = errno;
+
+        close(src);
+        close(dst);
+
+        errno = error;
+
+        return rval;
+      }
+
+      int clone_file(const path &from, const path &to) {
+#ifdef FICLONE
+        struct stat st = {};
+
+        int src = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (src == -1) {
           return PREP_FAILURE;
         }
 
-        if (chmod(to.c_str(), fst.st_mode)) {
-          log::perror(errno);
+        if (fstat(src, &st) == -1) {
+          close(src);
           return PREP_FAILURE;
         }
-        return PREP_SUCCESS;
+
+        int dst = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+
+        if (dst == -1) {
+          close(src);
+          return PREP_FAILURE;
+        }
+
+        int rval = ioctl(dst, FICLONE, src) == -1 ? PREP_FAILURE : PREP_SUCCESS;
+
+        close(src);
+        close(dst);
+
+        if (rval != PREP_SUCCESS) {
+          int error = errno;
+          unlink(to.c_str());
+          errno = error;
+        }
+
+        return rval;
+#else
+        errno = EOPNOTSUPP;
+        return PREP_FAILURE;
+#endif
       }
 
       int copy_directory(const std::string &from, const std::string &to, bool overwrite) {
-        FTS *file_system = nullptr;
-        FTSENT *parent = nullptr;
         int rval = PREP_SUCCESS;
-        char buf[PATH_MAX + 1] = {0};
-        struct stat st = {0}, mode = {0};
+        struct stat mode = {0};
+        // copied once the folders are made
+        std::vector<std::pair<std::string, std::string>> files;
 
         if (directory_exists(from) != PREP_SUCCESS) {
           log::perror(from, " is not a directory");
@@ -422,64 +1426,68 @@ namespace micrantha {
           }
         }
 
-        char *const paths[] = {(char *const) from.c_str(), nullptr};
-
-        file_system = fts_open(paths, FTS_COMFOLLOW | FTS_NOCHDIR, nullptr);
+        walk::Options options;
 
-        if (file_system == nullptr) {
-          log::perror("unable to open file system");
-          return PREP_FAILURE;
-        }
+        options.follow_root = true;
 
-        while ((parent = fts_read(file_system)) != nullptr) {
-          // get the repo path
-          snprintf(buf, PATH_MAX, "%s%s", to.c_str(), parent->fts_path + from.length());
+        options.enter = [&to, &mode, &rval](const walk::Entry &entry) {
+          struct stat st = {};
 
-          // check the install file is a directory
-          if (parent->fts_info == FTS_D) {
+          auto dir = entry.depth == 0 ? to : build_path(to, entry.path());
 
-            if (stat(buf, &st) == 0) {
-              if (S_ISDIR(st.st_mode)) {
-                log::trace("directory ", buf, " already exists");
-              } else {
-                log::perror("non-directory file already found for ", buf);
-                rval = PREP_FAILURE;
-              }
-              continue;
-            }
-
-            // doesn't exist, create the repo path directory
-            if (create_path(buf, mode.st_mode)) {
-              log::perror("Could not create ", buf);
+          if (stat(dir.c_str(), &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+              log::trace("directory ", dir, " already exists");
+            } else {
+              log::perror("non-directory file already found for ", dir);
               rval = PREP_FAILURE;
-              break;
             }
+            return walk::NEXT;
+          }
 
-            continue;
+          // doesn't exist, create the repo path directory
+          if (create_path(dir, mode.st_mode)) {
+            log::perror("Could not create ", dir);
+            rval = PREP_FAILURE;
+            return walk::STOP;
           }
 
-          if (parent->fts_info != FTS_F) {
-            log::debug("skipping non-regular file ", buf);
-            continue;
+          return walk::NEXT;
+        };
+
+        options.file = [&from, &to, &files, overwrite](const walk::Entry &entry) {
+          struct stat st = {};
+
+          auto path = entry.path();
+          auto dest = build_path(to, path);
+
+          if (entry.type != DT_REG) {
+            log::debug("skipping non-regular file ", dest);
+            return walk::NEXT;
           }
 
-          if (!overwrite) {
-            if (stat(buf, &st) == 0) {
-              log::debug("skipping existing regular file file ", buf);
-              continue;
-            }
+          if (!overwrite && stat(dest.c_str(), &st) == 0) {
+            log::debug("skipping existing regular file file ", dest);
+            return walk::NEXT;
           }
 
-          log::debug("copying [", parent->fts_path, "] to [", buf, "]");
+          auto src = build_path(from, path);
 
-          if (copy_file(parent->fts_path, buf) == PREP_FAILURE) {
-            log::perror("unable to link [", strerror(errno), "]");
-            rval = PREP_FAILURE;
-            break;
-          }
+          log::debug("copying [", src, "] to [", dest, "]");
+
+          files.emplace_back(std::move(src), std::move(dest));
+
+          return walk::NEXT;
+        };
+
+        if (walk::tree(from, options) == PREP_ERROR) {
+          log::perror("unable to read ", from);
+          rval = PREP_FAILURE;
         }
 
-        fts_close(file_system);
+        if (rval == PREP_SUCCESS && internal::copy_files(files) != PREP_SUCCESS) {
+          rval = PREP_FAILURE;
+        }
 
         return rval;
       }
@@ -1,15 +1,27 @@
 #ifndef MICRANTHA_PREP_UTIL_H
 #define MICRANTHA_PREP_UTIL_H
 
+#include <chrono>
+#include <cstdint>
+#include <iostream>
 #include <string>
+#include <string_view>
 #include <sys/stat.h>
 #include <sstream>
+#include <vector>
 
 namespace micrantha {
   namespace prep {
 
     namespace string {
       bool equals(const std::string &left, const std::string &right);
+
+      /**
+       * hashes a value into a key that is stable across runs (FNV-1a)
+       * @param value the value to hash
+       * @return the hash as a hexadecimal string
+       */
+      std::string hash(const std::string &value);
     }
 
     namespace filesystem {
@@ -24,20 +36,93 @@ namespace micrantha {
       using path = std::string;
 
       /**
-       * removes an entire directory hierarchy
+       * removes an entire directory hierarchy, with several threads for a large one.  symbolic
+       * links are removed rather than followed, and other file systems are not entered.
+       * @return PREP_SUCCESS or PREP_FAILURE if anything could not be removed
        */
       int remove_directory(const path &path);
 
       /**
-       * tests if a directory exists
+       * moves a directory into a trash folder on the same file system, to be removed by empty_trash
+       * @return PREP_SUCCESS, or PREP_FAILURE with errno set if it could not be moved
+       */
+      int move_to_trash(const path &dir, const path &trash);
+
+      // the environment variable a process started by empty_trash finds its trash folder in
+      constexpr const char *const TRASH_VARIABLE = "PREP_EMPTY_TRASH";
+
+      /**
+       * starts another prep process to remove everything in a trash folder, without waiting for it
+       * @return PREP_SUCCESS if the trash is empty or being emptied, otherwise PREP_FAILURE
+       */
+      int empty_trash(const path &trash);
+
+      /**
+       * removes everything in a trash folder, for the process started by empty_trash.
+       * one process empties a trash folder at a time.
+       * @return PREP_SUCCESS if the trash was emptied or another process is emptying it
+       */
+      int remove_trash(const path &trash);
+
+      /**
+       * closes the descriptors above stderr that empty_trash could not keep from being inherited
+       */
+      void close_inherited();
+
+      /**
+       * tests if a directory exists.  the answer is remembered for the path, found or not, until it
+       * is invalidated.
        * @return PREP_SUCCESS if exists, PREP_FAILURE if it doesn't or PREP_ERROR upon error
        */
       int directory_exists(const path &path);
 
+      /**
+       * gets the mode of a path, following symbolic links, from what was last seen of it
+       * @param mode set to the mode of the path if it exists
+       * @return zero, or the errno if it could not be found
+       */
+      int stat_cached(const path &path, mode_t &mode);
+
+      /**
+       * forgets what was seen of a path and everything under it, for when it is changed
+       */
+      void invalidate(const path &path);
+
+      /**
+       * forgets everything seen, for when something else may have changed the file system
+       */
+      void invalidate();
+
+      typedef struct {
+        // answered from what was seen
+        size_t hits;
+        // looked up
+        size_t misses;
+      } StatCounts;
+
+      /**
+       * @return how often stat_cached has been answered without a look up
+       */
+      StatCounts stat_counts();
+
       int directory_empty(const path &path);
 
       /**
-       * copies an entire directory to another directory
+       * adds up the space taken by everything under a path, without following links
+       * @param bytes set to the space taken on disk
+       * @return PREP_SUCCESS, or PREP_FAILURE if anything could not be read
+       */
+      int disk_usage(const path &path, uint64_t &bytes);
+
+      /**
+       * gets the space left for unprivileged use on the file system holding a path
+       * @param bytes set to the space available
+       * @return PREP_SUCCESS, or PREP_FAILURE with errno set
+       */
+      int free_space(const path &path, uint64_t &bytes);
+
+      /**
+       * copies an entire directory to another directory, large trees with several files at once
        * @param overwrite set to true to overwrite the to directory
        * @return PREP_SUCESS or PREP_FAILURE upon error
        */
@@ -67,10 +152,18 @@ namespace micrantha {
       int create_path(const path &dir, mode_t mode = S_IRWXU | S_IRWXG | S_IRWXO);
 
       /**
-       * copies one file to another given their names
+       * copies one file to another given their names.  the data is shared where the file system can,
+       * otherwise copied in the kernel, and holes in a sparse file stay holes.
+       * @return PREP_SUCCESS, or PREP_FAILURE with errno set
        */
       int copy_file(const path &from, const path &to);
 
+      /**
+       * makes a copy of a file that shares its data until either is changed (a reflink)
+       * @return PREP_SUCCESS, or PREP_FAILURE with errno set if the file system can not
+       */
+      int clone_file(const path &from, const path &to);
+
       void build_path(std::ostream &buf);
 
       template<class A0, class... Args>
@@ -112,6 +205,125 @@ namespace micrantha {
        */
       ssize_t read_line(int fd, std::string &buf);
 
+      /**
+       * creates a file that only exists while it is open, in memory where supported
+       * @param name a name for the file, only for show
+       * @return the file descriptor, closed on exec, or -1 on error
+       */
+      int temporary_file(const char *name);
+
+      /**
+       * makes a temporary file read only, where supported, and rewinds it for reading
+       * @return PREP_SUCCESS or PREP_ERROR on error
+       */
+      int seal_file(int fd);
+
+      /**
+       * reads lines from a file descriptor through a buffer, so output is read in blocks
+       * instead of a byte at a time. a partial line is carried over to the next read.
+       */
+      class LineReader {
+       public:
+        /**
+         * @param fd the file descriptor to read
+         * @param capacity the initial size of the buffer, grown for longer lines
+         */
+        explicit LineReader(int fd, size_t capacity = 64 * 1024);
+
+        /**
+         * reads what is available on the descriptor into the buffer with a single read
+         * @return the number of bytes read, 0 on end of file or -1 on error
+         */
+        ssize_t fill();
+
+        /**
+         * gets the next complete line from the buffer, without the line ending.
+         * after end of file a trailing partial line is returned as well.
+         * @param line set to the line
+         * @return true if a line was set
+         */
+        bool next(std::string &line);
+
+        /**
+         * gets an exact number of bytes from the buffer, line endings and all
+         * @param count the number of bytes wanted
+         * @param block set to the bytes
+         * @return true if enough bytes were buffered to set the block
+         */
+        bool next(size_t count, std::string &block);
+
+        /**
+         * @return true if the descriptor has reached end of file
+         */
+        bool eof() const;
+
+        int fd() const;
+
+       private:
+        int fd_;
+        std::vector<char> buf_;
+        // the unread part of the buffer
+        size_t begin_;
+        size_t end_;
+        bool eof_;
+      };
+
+      /**
+       * collects lines for a file descriptor and writes them together with a single writev,
+       * once enough bytes are pending or the oldest line has waited long enough
+       */
+      class LineWriter {
+       public:
+        /**
+         * @param fd the file descriptor to write
+         * @param limit the number of pending bytes that causes a flush
+         * @param latency how long a line may be pending before it causes a flush
+         */
+        explicit LineWriter(int fd, size_t limit = 64 * 1024,
+                            std::chrono::milliseconds latency = std::chrono::milliseconds(50));
+
+        /* flushes any pending lines */
+        ~LineWriter();
+
+        /* non-copyable */
+        LineWriter(const LineWriter &other) = delete;
+
+        LineWriter &operator=(const LineWriter &other) = delete;
+
+        /**
+         * queues a line, flushing if a threshold is reached
+         * @return the number of bytes queued or -1 if a flush failed
+         */
+        ssize_t write_line(std::string_view line);
+
+        /**
+         * queues a line put after a prefix, flushing if a threshold is reached
+         * @return the number of bytes queued or -1 if a flush failed
+         */
+        ssize_t write_line(std::string_view prefix, std::string_view line);
+
+        /**
+         * writes all pending lines
+         * @return the number of bytes written or -1 on error
+         */
+        ssize_t flush();
+
+        /**
+         * @return the milliseconds until the pending lines are due, or -1 if nothing is pending
+         */
+        long due() const;
+
+        bool empty() const;
+
+       private:
+        int fd_;
+        size_t limit_;
+        std::chrono::milliseconds latency_;
+        std::vector<std::string> pending_;
+        size_t size_;
+        std::chrono::steady_clock::time_point since_;
+      };
+
       /**
        * utility method for variadic print
        * @param os the output stream
@@ -188,6 +400,54 @@ namespace micrantha {
       constexpr static const int NotFound = 127;
       constexpr static const int NotAvailable = 128;
 
+      // a command ran past its time limit, as timeout(1) reports it
+      constexpr static const int TimedOut = 124;
+      // a command went too long without output
+      constexpr static const int Stalled = 125;
+
+      // the descriptor a command is given a request on
+      constexpr static const int RequestFileno = 3;
+
+      /**
+       * a child process and the descriptors used to talk to it
+       */
+      typedef struct Child {
+        pid_t pid = -1;
+        // written to for the child's stdin
+        int input = -1;
+        // read for the child's stdout, or all output on a terminal
+        int output = -1;
+        // read for the child's stderr, -1 on a terminal
+        int error = -1;
+        // true if the child runs on a pseudo terminal
+        bool terminal = false;
+      } Child;
+
+      /**
+       * closes the descriptors of a child process
+       */
+      void close(Child &child);
+
+      /**
+       * starts a command in its own session with its input and output on pipes
+       * @param command the path of the executable
+       * @param argv the arguments for the command
+       * @param directory the working directory of the command, or nullptr
+       * @param envp the environment of the command
+       * @param child set to the started process
+       * @param request a descriptor the command is given as RequestFileno, or -1
+       * @return PREP_SUCCESS or PREP_ERROR upon error
+       */
+      int spawn_pipes(const std::string &command, char *const argv[], const char *directory, char *const envp[],
+                      Child &child, int request = -1);
+
+      /**
+       * starts a command on a new pseudo terminal with local echo disabled
+       * @see spawn_pipes
+       */
+      int spawn_terminal(const std::string &command, char *const argv[], const char *directory,
+                         char *const envp[], Child &child, int request = -1);
+
       /**
        * runs a command in a forked process
        * @return PREP_SUCCESS or PREP_FAILURE upon error
@@ -0,0 +1,392 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "common.h"
+#include "walk.h"
+
+namespace micrantha {
+  namespace prep {
+    namespace walk {
+
+      namespace internal {
+        // how much of a folder is read at once
+        constexpr static const size_t READ_SIZE = 32 * 1024;
+
+        // the most threads a walk starts
+        constexpr static const size_t MAX_THREADS = 8;
+
+        const std::string NO_FOLDER;
+
+        /**
+         * reads the entries of a folder in bulk
+         * @param entry called with the name and type of each entry
+         * @return zero, or the errno if the folder could not be read
+         */
+        int read_folder(int fd, const std::function<bool(const char *, unsigned char)> &entry) {
+#if defined(__linux__) && defined(SYS_getdents64)
+          struct linux_dirent64 {
+            ino64_t d_ino;
+            off64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+          };
+
+          alignas(linux_dirent64) char buf[READ_SIZE];
+
+          for (;;) {
+            auto n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+
+            if (n == 0) {
+              return 0;
+            }
+
+            if (n == -1) {
+              if (errno == EINTR) {
+                continue;
+              }
+              return errno;
+            }
+
+            for (long pos = 0; pos < n;) {
+              auto dirent = reinterpret_cast<struct linux_dirent64 *>(buf + pos);
+
+              pos += dirent->d_reclen;
+
+              if (!entry(dirent->d_name, dirent->d_type)) {
+                return 0;
+              }
+            }
+          }
+#else
+          // the folder keeps its own descriptor, closed by the caller
+          int copy = dup(fd);
+
+          DIR *dir = copy == -1 ? nullptr : fdopendir(copy);
+
+          if (dir == nullptr) {
+            int error = errno;
+
+            if (copy != -1) {
+              close(copy);
+            }
+
+            return error;
+          }
+
+          struct dirent *dirent = nullptr;
+
+          while ((dirent = readdir(dir)) != nullptr) {
+            if (!entry(dirent->d_name, dirent->d_type)) {
+              break;
+            }
+          }
+
+          closedir(dir);
+
+          return 0;
+#endif
+        }
+
+        /**
+         * walks a tree.  read folders wait on a stack, so the walk goes deep before wide and few folders
+         * are open at once.  a folder is kept open until everything in it is done, for its entries to be
+         * used relative to it.
+         */
+        class Walker {
+         public:
+          explicit Walker(const Options &options)
+              : options_(options), device_(0), busy_(0), done_(false), stopped_(false), failed_(false) {}
+
+          ~Walker() {
+            // what was left open when stopped
+            for (auto &folder : folders_) {
+              if (folder->fd != -1) {
+                close(folder->fd);
+              }
+            }
+          }
+
+          int walk(const std::string &root) {
+            int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (options_.follow_root ? 0 : O_NOFOLLOW);
+
+            Entry entry{AT_FDCWD, root.c_str(), NO_FOLDER, DT_DIR, 0};
+
+            int fd = open(root.c_str(), flags);
+
+            struct stat st = {};
+
+            if (fd == -1 || fstat(fd, &st) == -1) {
+              int error = errno;
+
+              if (fd != -1) {
+                close(fd);
+              }
+
+              if (options_.error) {
+                options_.error(entry, error);
+              }
+
+              errno = error;
+
+              return PREP_ERROR;
+            }
+
+            device_ = st.st_dev;
+
+            folders_.emplace_back(new Folder{nullptr, fd, "", root, 0, {1}});
+
+            auto action = visit(options_.enter, entry);
+
+            if (action == SKIP || action == STOP) {
+              return action == STOP ? PREP_FAILURE : PREP_SUCCESS;
+            }
+
+            stack_.push_back(folders_.back().get());
+
+            work();
+
+            for (auto &thread : threads_) {
+              thread.join();
+            }
+
+            if (stopped_) {
+              return PREP_FAILURE;
+            }
+
+            return failed_ ? PREP_ERROR : PREP_SUCCESS;
+          }
+
+         private:
+          typedef struct Folder {
+            struct Folder *parent;
+            // open until everything in the folder is done
+            int fd;
+            // relative to the root
+            std::string path;
+            // in the folder above
+            std::string name;
+            int depth;
+            // folders inside not yet done, and one more until this has been read
+            std::atomic_size_t pending;
+          } Folder;
+
+          Action visit(const visitor &visitor, const Entry &entry) {
+            if (!visitor) {
+              return NEXT;
+            }
+
+            auto action = visitor(entry);
+
+            if (action == STOP) {
+              stopped_ = true;
+            }
+
+            return action;
+          }
+
+          void fail(const Entry &entry, int error) {
+            failed_ = true;
+
+            if (options_.error) {
+              options_.error(entry, error);
+            }
+          }
+
+          // queues a folder to read, starting another thread if others are waiting
+          void push(Folder *parent, const char *name) {
+            auto path = parent->path.empty() ? std::string(name) : parent->path + '/' + name;
+
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            folders_.emplace_back(new Folder{parent, -1, std::move(path), name, parent->depth + 1, {1}});
+
+            stack_.push_back(folders_.back().get());
+
+            if (stack_.size() > 1 && threads_.size() + 1 < max_threads()) {
+              try {
+                threads_.emplace_back(&Walker::work, this);
+              } catch (const std::system_error &) {
+                // the threads already walking will do
+              }
+            }
+
+            ready_.notify_one();
+          }
+
+          void work() {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            for (;;) {
+              ready_.wait(lock, [this]() { return done_ || !stack_.empty(); });
+
+              if (done_) {
+                return;
+              }
+
+              auto folder = stack_.back();
+
+              stack_.pop_back();
+
+              busy_++;
+
+              lock.unlock();
+
+              if (!stopped_) {
+                read(folder);
+              }
+
+              lock.lock();
+
+              if (--busy_ == 0 && stack_.empty()) {
+                done_ = true;
+                ready_.notify_all();
+              }
+            }
+          }
+
+          // visits what is in a folder and queues the folders
+          void read(Folder *folder) {
+            int parent = folder->parent != nullptr ? folder->parent->fd : AT_FDCWD;
+
+            Entry self{parent, folder->name.c_str(), folder->parent != nullptr ? folder->parent->path : NO_FOLDER,
+                       DT_DIR, folder->depth};
+
+            if (folder->fd == -1) {
+              folder->fd = openat(parent, folder->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+              if (folder->fd == -1) {
+                fail(self, errno);
+                finish(folder, false);
+                return;
+              }
+
+              struct stat st = {};
+
+              // another file system is left unread
+              if (options_.same_device && (fstat(folder->fd, &st) == -1 || st.st_dev != device_)) {
+                finish(folder, true);
+                return;
+              }
+            }
+
+            auto fd = folder->fd;
+
+            int error = read_folder(fd, [this, folder, fd](const char *name, unsigned char type) {
+              if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                return true;
+              }
+
+              Entry entry{fd, name, folder->path, type, folder->depth + 1};
+
+              if (entry.type == DT_UNKNOWN) {
+                struct stat st = {};
+
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                  fail(entry, errno);
+                  return !stopped_;
+                }
+
+                entry.type = IFTODT(st.st_mode);
+              }
+
+              if (entry.type != DT_DIR) {
+                visit(options_.file, entry);
+                return !stopped_;
+              }
+
+              if (visit(options_.enter, entry) == NEXT) {
+                folder->pending++;
+                push(folder, name);
+              }
+
+              return !stopped_;
+            });
+
+            if (error != 0) {
+              fail(self, error);
+            }
+
+            finish(folder, true);
+          }
+
+          /**
+           * leaves a folder once everything in it is done, and so on up the tree
+           * @param leave false if the folder itself should not be left, as it could not be read
+           */
+          void finish(Folder *folder, bool leave) {
+            while (folder != nullptr && --folder->pending == 0) {
+              auto parent = folder->parent;
+
+              if (leave && !stopped_) {
+                Entry entry{parent != nullptr ? parent->fd : AT_FDCWD, folder->name.c_str(),
+                            parent != nullptr ? parent->path : NO_FOLDER, DT_DIR, folder->depth};
+
+                visit(options_.leave, entry);
+              }
+
+              if (folder->fd != -1) {
+                close(folder->fd);
+                folder->fd = -1;
+              }
+
+              leave = true;
+              folder = parent;
+            }
+          }
+
+          size_t max_threads() const {
+            return std::max<size_t>(1, std::min<size_t>({options_.threads, MAX_THREADS,
+                                                         std::max(1U, std::thread::hardware_concurrency())}));
+          }
+
+          const Options &options_;
+          dev_t device_;
+          std::mutex mutex_;
+          std::condition_variable ready_;
+          std::vector<Folder *> stack_;
+          std::vector<std::unique_ptr<Folder>> folders_;
+          std::vector<std::thread> threads_;
+          size_t busy_;
+          bool done_;
+          std::atomic_bool stopped_;
+          std::atomic_bool failed_;
+        };
+      }  // namespace internal
+
+      std::string Entry::path() const {
+        if (depth == 0) {
+          return "";
+        }
+
+        if (folder.empty()) {
+          return name;
+        }
+
+        return folder + '/' + name;
+      }
+
+      int tree(const std::string &root, const Options &options) {
+        internal::Walker walker(options);
+
+        return walker.walk(root);
+      }
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef MICRANTHA_PREP_WALK_H
+#define MICRANTHA_PREP_WALK_H
+
+#include <functional>
+#include <string>
+
+namespace micrantha {
+  namespace prep {
+    namespace walk {
+
+      /**
+       * something found in a walk
+       */
+      struct Entry {
+        // the folder holding the entry, open for use with the *at calls
+        int dirfd;
+        // the name of the entry in that folder, or the root as given
+        const char *name;
+        // the folder holding the entry relative to the root, empty for the root and what is in it
+        const std::string &folder;
+        // the type as a DT_ value, looked up if the file system does not give it
+        unsigned char type;
+        // zero for the root, one for what is in it, and so on
+        int depth;
+
+        /**
+         * @return the path of the entry relative to the root, empty for the root
+         */
+        std::string path() const;
+      };
+
+      typedef enum {
+        // carry on
+        NEXT,
+        // don't read this folder
+        SKIP,
+        // end the walk
+        STOP
+      } Action;
+
+      typedef std::function<Action(const Entry &entry)> visitor;
+
+      typedef struct Options {
+        // a folder, before anything in it
+        visitor enter;
+        // anything that is not a folder
+        visitor file;
+        // a folder, once everything in it has been visited
+        visitor leave;
+        // a folder or file that could not be read, with the errno
+        std::function<void(const Entry &entry, int error)> error;
+        // the most threads reading folders, visitors must be thread safe for more than one
+        size_t threads = 1;
+        // don't read folders on another file system
+        bool same_device = false;
+        // follow the root if it is a symbolic link, other links are never followed
+        bool follow_root = false;
+      } Options;
+
+      /**
+       * visits everything under a folder.  folders are read in bulk relative to the folder above,
+       * and only entries the file system gives no type for are looked up.  with more than one thread,
+       * folders waiting to be read are shared out, but a folder is always entered before anything in
+       * it and left after.
+       * @param root the folder to walk
+       * @return PREP_SUCCESS, PREP_FAILURE if a visitor stopped the walk, or PREP_ERROR if something
+       * could not be read
+       */
+      int tree(const std::string &root, const Options &options);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "bench.h"
+#include "common.h"
+#include "util.h"
+
+using namespace micrantha::prep;
+
+namespace {
+  constexpr const size_t FILES = 5000;
+
+  // linking a package into the repository: check what is there, link, and later unlink
+  bench::Benchmark batched("batch", []() {
+    auto path = filesystem::make_temp_dir();
+    auto target = filesystem::build_path(path, "target");
+    std::vector<std::string> links;
+
+    filesystem::create_path(target);
+
+    for (size_t i = 0; i < FILES; i++) {
+      links.push_back(filesystem::build_path(path, "link" + std::to_string(i)));
+    }
+
+    bench::report("syscall per file (per link)", bench::measure(5, [&]() {
+      struct stat st = {};
+
+      for (const auto &link : links) {
+        if (lstat(link.c_str(), &st) == -1) {
+          symlink(target.c_str(), link.c_str());
+        }
+      }
+
+      for (const auto &link : links) {
+        unlink(link.c_str());
+      }
+    }) / FILES, "us");
+
+    batch::Queue queue;
+
+    bench::report(queue.is_async() ? "io_uring batch (per link)" : "fallback batch (per link)",
+                  bench::measure(5, [&]() {
+                    std::vector<struct stat> st(FILES);
+
+                    for (size_t i = 0; i < FILES; i++) {
+                      queue.lstat(links[i], &st[i]);
+                    }
+
+                    queue.flush();
+
+                    for (const auto &link : links) {
+                      queue.symlink(target, link);
+                    }
+
+                    queue.flush();
+
+                    for (const auto &link : links) {
+                      queue.unlink(link);
+                    }
+
+                    queue.flush();
+                  }) / FILES, "us");
+
+    filesystem::remove_directory(path);
+  });
+}
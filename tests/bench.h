@@ -0,0 +1,38 @@
+#ifndef MICRANTHA_PREP_BENCH_H
+#define MICRANTHA_PREP_BENCH_H
+
+#include <functional>
+#include <string>
+
+namespace micrantha {
+  namespace prep {
+    namespace bench {
+
+      /**
+       * registers a benchmark with the harness when constructed
+       */
+      class Benchmark {
+       public:
+        Benchmark(const std::string &name, const std::function<void()> &body);
+      };
+
+      /**
+       * times a function
+       * @param iterations the number of times to run the function
+       * @param body the function to time
+       * @return the average time of one iteration in microseconds
+       */
+      double measure(size_t iterations, const std::function<void()> &body);
+
+      /**
+       * prints a measurement
+       * @param label what was measured
+       * @param value the measurement
+       * @param unit the unit of the measurement
+       */
+      void report(const std::string &label, double value, const std::string &unit = "us");
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,57 @@
+#include <fstream>
+#include <string>
+
+#include "bench.h"
+#include "common.h"
+#include "util.h"
+
+using namespace micrantha::prep;
+
+namespace {
+  constexpr const size_t FILES = 400;
+
+  // a plugin like tree of about 40MB
+  std::string plugin_tree() {
+    auto path = filesystem::make_temp_dir();
+    std::string block(100 * 1024, 'x');
+
+    for (size_t i = 0; i < FILES; i++) {
+      auto dir = filesystem::build_path(path, "dir" + std::to_string(i % 20));
+
+      filesystem::create_path(dir);
+
+      std::ofstream out(filesystem::build_path(dir, "file" + std::to_string(i)));
+
+      out << block;
+    }
+
+    return path;
+  }
+
+  // copying a file at a time through streams, versus copy_directory
+  bench::Benchmark copy("copy", []() {
+    auto path = plugin_tree();
+    auto to = filesystem::make_temp_dir();
+
+    bench::report("rdbuf (per tree)", bench::measure(5, [&]() {
+      for (size_t i = 0; i < FILES; i++) {
+        auto dir = "dir" + std::to_string(i % 20);
+        auto file = "file" + std::to_string(i);
+
+        filesystem::create_path(filesystem::build_path(to, dir));
+
+        std::ifstream src(filesystem::build_path(path, dir, file), std::ios::binary);
+        std::ofstream dst(filesystem::build_path(to, dir, file), std::ios::binary);
+
+        dst << src.rdbuf();
+      }
+    }) / 1000, "ms");
+
+    bench::report("copy_directory (per tree)", bench::measure(5, [&]() {
+      filesystem::copy_directory(path, to, true);
+    }) / 1000, "ms");
+
+    filesystem::remove_directory(to);
+    filesystem::remove_directory(path);
+  });
+}
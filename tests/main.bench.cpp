@@ -0,0 +1,64 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "bench.h"
+
+namespace micrantha {
+  namespace prep {
+    namespace bench {
+
+      namespace internal {
+        typedef std::pair<std::string, std::function<void()>> entry;
+
+        std::vector<entry> &registry() {
+          static std::vector<entry> benchmarks;
+          return benchmarks;
+        }
+      }
+
+      Benchmark::Benchmark(const std::string &name, const std::function<void()> &body) {
+        internal::registry().emplace_back(name, body);
+      }
+
+      double measure(size_t iterations, const std::function<void()> &body) {
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < iterations; i++) {
+          body();
+        }
+
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+        return iterations ? elapsed.count() / iterations : 0;
+      }
+
+      void report(const std::string &label, double value, const std::string &unit) {
+        printf("  %-48s %12.2f %s\n", label.c_str(), value, unit.c_str());
+      }
+    }
+  }
+}
+
+using namespace micrantha::prep;
+
+// runs all benchmarks, or only those named on the command line
+int main(int argc, char *argv[]) {
+  for (const auto &entry : bench::internal::registry()) {
+    bool selected = argc < 2;
+
+    for (int i = 1; i < argc && !selected; i++) {
+      selected = entry.first == argv[i];
+    }
+
+    if (!selected) {
+      continue;
+    }
+
+    printf("%s\n", entry.first.c_str());
+
+    entry.second();
+  }
+  return 0;
+}
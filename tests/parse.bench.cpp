@@ -0,0 +1,76 @@
+#include <strings.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "protocol.h"
+
+using namespace micrantha::prep;
+
+namespace {
+  constexpr const size_t LINES = 100000;
+
+  // a verbose build log of about 7MB with the odd command in it
+  std::vector<std::string> build_log() {
+    std::vector<std::string> lines;
+
+    lines.reserve(LINES);
+
+    for (size_t i = 0; i < LINES; i++) {
+      if (i % 1000 == 0) {
+        lines.emplace_back("ECHO building part " + std::to_string(i / 1000));
+      } else if (i % 3 == 0) {
+        lines.emplace_back("error: this is not a command, unless it is");
+      } else {
+        lines.emplace_back("[ 42%] Building CXX object src/CMakeFiles/prep.dir/plugin.cpp.o");
+      }
+    }
+
+    lines.emplace_back("RETURN /tmp/source");
+
+    return lines;
+  }
+
+  // how commands were matched before the command table, one name at a time
+  bool on_command(const std::string &line, const std::string &command,
+                  const std::function<void(const std::string &)> &callback) {
+    size_t pos = command.length();
+
+    if (strcasecmp(line.substr(0, pos).c_str(), command.c_str())) {
+      return false;
+    }
+
+    callback(++pos < line.length() ? line.substr(pos) : "");
+    return true;
+  }
+
+  // classifying plugin output with a command per call versus the command table
+  bench::Benchmark parse("parse", []() {
+    auto lines = build_log();
+    size_t commands = 0;
+
+    bench::report("on_command (per line)", bench::measure(10, [&]() {
+      auto count = [&](const std::string &) { commands++; };
+
+      for (auto &line : lines) {
+        on_command(line, "RETURN", count) || on_command(line, "DONE", count) ||
+            on_command(line, "ECHO", count) || on_command(line, "ERROR", count) ||
+            on_command(line, "EMIT", count);
+      }
+    }) / lines.size() * 1000, "ns");
+
+    bench::report("classify (per line)", bench::measure(10, [&]() {
+      std::string_view args;
+
+      for (auto &line : lines) {
+        if (protocol::classify(line, args) != protocol::Command::NONE) {
+          commands++;
+        }
+      }
+    }) / lines.size() * 1000, "ns");
+
+    // keeps the loops from being optimized away
+    bench::report("commands", commands, "");
+  });
+}
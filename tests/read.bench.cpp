@@ -0,0 +1,66 @@
+#include <unistd.h>
+#include <cstring>
+#include <thread>
+
+#include "bench.h"
+#include "common.h"
+#include "util.h"
+
+using namespace micrantha::prep;
+
+namespace {
+  constexpr const size_t LINES = 100000;
+
+  // writes a verbose build log into a pipe from another thread
+  std::thread write_log(int fd) {
+    return std::thread([fd]() {
+      std::string line = "[ 42%] Building CXX object src/CMakeFiles/prep.dir/plugin.cpp.o\r\n";
+
+      for (size_t i = 0; i < LINES; i++) {
+        ::write(fd, line.c_str(), line.size());
+      }
+      ::close(fd);
+    });
+  }
+
+  // reading plugin output a byte at a time versus through a buffer
+  bench::Benchmark read("read", []() {
+    bench::report("read_line (per line)", bench::measure(1, []() {
+      int fds[2];
+      std::string line;
+
+      if (pipe(fds)) {
+        return;
+      }
+
+      auto writer = write_log(fds[1]);
+
+      while (io::read_line(fds[0], line) > 0) {
+      }
+
+      writer.join();
+      close(fds[0]);
+    }) / LINES);
+
+    bench::report("LineReader (per line)", bench::measure(1, []() {
+      int fds[2];
+      std::string line;
+
+      if (pipe(fds)) {
+        return;
+      }
+
+      auto writer = write_log(fds[1]);
+
+      io::LineReader reader(fds[0]);
+
+      while (reader.fill() > 0) {
+        while (reader.next(line)) {
+        }
+      }
+
+      writer.join();
+      close(fds[0]);
+    }) / LINES);
+  });
+}
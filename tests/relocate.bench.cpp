@@ -0,0 +1,69 @@
+#include <fstream>
+#include <string>
+
+#include "bench.h"
+#include "common.h"
+#include "relocate.h"
+#include "util.h"
+
+using namespace micrantha::prep;
+
+namespace {
+  constexpr const size_t FILES = 200;
+
+  constexpr const char *const PREFIX = "/home/someone/project/.prep";
+
+  // an install tree of about 20MB, a few files of which mention where it was built
+  std::string install_tree() {
+    auto path = filesystem::make_temp_dir();
+    std::string block(100 * 1024, 'x');
+
+    for (size_t i = 0; i < FILES; i++) {
+      std::ofstream out(filesystem::build_path(path, "file" + std::to_string(i)));
+
+      out << block;
+
+      if (i % 20 == 0) {
+        out << "prefix=" << PREFIX << "/kitchen/install/dep\n";
+      }
+    }
+
+    return path;
+  }
+
+  // only searching files for an old prefix line by line, versus finding and replacing it with rewrite_tree
+  bench::Benchmark relocate("relocate", []() {
+    auto path = install_tree();
+    size_t found = 0;
+
+    bench::report("string::find (per tree)", bench::measure(5, [&]() {
+      for (size_t i = 0; i < FILES; i++) {
+        std::ifstream in(filesystem::build_path(path, "file" + std::to_string(i)));
+        std::string line;
+
+        while (std::getline(in, line)) {
+          if (line.find(PREFIX) != std::string::npos) {
+            found++;
+          }
+        }
+      }
+    }) / 1000, "ms");
+
+    // moving the tree back and forth, so every pass has the prefix to replace
+    bool moved = false;
+
+    bench::report("rewrite_tree (per tree)", bench::measure(5, [&]() {
+      relocate::Stats stats;
+
+      relocate::rewrite_tree(path, moved ? "/elsewhere/.prep" : PREFIX, moved ? PREFIX : "/elsewhere/.prep", stats);
+
+      moved = !moved;
+      found += stats.files;
+    }) / 1000, "ms");
+
+    // keeps the loops from being optimized away
+    bench::report("found", found, "");
+
+    filesystem::remove_directory(path);
+  });
+}
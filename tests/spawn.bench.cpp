@@ -0,0 +1,53 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "bench.h"
+#include "common.h"
+#include "util.h"
+
+using namespace micrantha::prep;
+
+namespace {
+  constexpr const char *const COMMAND = "/bin/true";
+
+  constexpr const size_t ITERATIONS = 200;
+
+  // spawn latency as the parent grows, fork copies page tables while posix_spawn does not
+  bench::Benchmark spawn("spawn", []() {
+    char *const argv[] = {const_cast<char *>(COMMAND), nullptr};
+    char *const envp[] = {nullptr};
+
+    for (size_t megabytes : {0, 256, 1024}) {
+      // touch the memory so it is mapped like a parsed graph would be
+      std::unique_ptr<char[]> ballast(new char[megabytes * 1024 * 1024 + 1]);
+      memset(ballast.get(), 1, megabytes * 1024 * 1024 + 1);
+
+      auto suffix = " (" + std::to_string(megabytes) + "MB resident)";
+
+      bench::report("fork_command" + suffix, bench::measure(ITERATIONS, [&]() {
+        process::fork_command(COMMAND, argv, nullptr, envp);
+      }));
+
+      bench::report("spawn_pipes" + suffix, bench::measure(ITERATIONS, [&]() {
+        process::Child child;
+
+        if (process::spawn_pipes(COMMAND, argv, nullptr, envp, child) == PREP_SUCCESS) {
+          waitpid(child.pid, nullptr, 0);
+          process::close(child);
+        }
+      }));
+
+      bench::report("spawn_terminal" + suffix, bench::measure(ITERATIONS, [&]() {
+        process::Child child;
+
+        if (process::spawn_terminal(COMMAND, argv, nullptr, envp, child) == PREP_SUCCESS) {
+          waitpid(child.pid, nullptr, 0);
+          process::close(child);
+        }
+      }));
+    }
+  });
+}
@@ -1,7 +1,26 @@
 #include <bandit/bandit.h>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
 #include <fstream>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <common.h>
+#include "elf_file.h"
+#include "event_loop.h"
+#include "log_file.h"
+#include "package.h"
+#include "plugin.h"
+#include "protocol.h"
+#include "relocate.h"
+#include "repository.h"
+#include "task.h"
 #include "util.h"
+#include "walk.h"
 
 using namespace micrantha;
 using namespace bandit;
@@ -53,16 +72,828 @@ go_bandit([]() {
 
             Assert::That(directory_exists(path), !Equals(PREP_SUCCESS));
         });
+
+        it("keeps the holes of a sparse file when copying", []() {
+            auto path = make_temp_dir();
+
+            auto from = build_path(path, "sparse.file");
+            auto to = build_path(path, "copy.file");
+
+            int fd = open(from.c_str(), O_WRONLY | O_CREAT, 0640);
+
+            Assert::That(pwrite(fd, "start", 5, 0), Equals(5));
+            Assert::That(pwrite(fd, "end", 3, 16 * 1024 * 1024), Equals(3));
+
+            close(fd);
+
+            Assert::That(copy_file(from, to), Equals(PREP_SUCCESS));
+
+            struct stat fst = {}, tst = {};
+
+            Assert::That(stat(from.c_str(), &fst), Equals(0));
+            Assert::That(stat(to.c_str(), &tst), Equals(0));
+
+            Assert::That(tst.st_size, Equals(fst.st_size));
+            Assert::That(tst.st_mode, Equals(fst.st_mode));
+            Assert::That(tst.st_blocks, IsLessThan(fst.st_size / 512));
+
+            char buf[3] = {0};
+
+            fd = open(to.c_str(), O_RDONLY);
+
+            Assert::That(pread(fd, buf, sizeof(buf), 16 * 1024 * 1024), Equals(3));
+
+            close(fd);
+
+            Assert::That(std::string(buf, sizeof(buf)), Equals("end"));
+
+            remove_directory(path);
+        });
+
+        it("can copy a large directory", []() {
+            auto path = make_temp_dir();
+
+            auto from = build_path(path, "from");
+
+            for (int i = 0; i < 200; i++) {
+                auto dir = build_path(from, std::to_string(i % 10));
+
+                create_path(dir);
+
+                std::ofstream f(build_path(dir, std::to_string(i)));
+
+                f << i << "\n";
+            }
+
+            auto to = build_path(path, "to");
+
+            Assert::That(copy_directory(from, to), Equals(PREP_SUCCESS));
+
+            for (int i = 0; i < 200; i++) {
+                std::ifstream f(build_path(to, std::to_string(i % 10), std::to_string(i)));
+                int value = -1;
+
+                f >> value;
+
+                Assert::That(value, Equals(i));
+            }
+
+            remove_directory(path);
+        });
+    });
+
+    describe("remove", []() {
+        using namespace prep::filesystem;
+
+        it("removes a tree without following links", []() {
+            auto path = make_temp_dir();
+
+            auto outside = build_path(path, "outside");
+            auto tree = build_path(path, "tree");
+
+            create_path(outside);
+
+            std::ofstream(build_path(outside, "keep")) << "keep\n";
+
+            for (int i = 0; i < 100; i++) {
+                auto dir = build_path(tree, std::to_string(i % 10), std::to_string(i));
+
+                create_path(dir);
+
+                std::ofstream(build_path(dir, "file")) << i << "\n";
+            }
+
+            Assert::That(symlink(outside.c_str(), build_path(tree, "link").c_str()), Equals(0));
+
+            Assert::That(remove_directory(tree), Equals(PREP_SUCCESS));
+
+            Assert::That(directory_exists(tree), !Equals(PREP_SUCCESS));
+
+            Assert::That(file_exists(build_path(outside, "keep")), Equals(PREP_SUCCESS));
+
+            remove_directory(path);
+        });
+
+        it("can move a directory to the trash", []() {
+            auto path = make_temp_dir();
+
+            auto trash = build_path(path, "trash");
+            auto build = build_path(path, "build");
+
+            create_path(trash);
+
+            for (int i = 0; i < 2; i++) {
+                create_path(build_path(build, "sub"));
+
+                Assert::That(move_to_trash(build, trash), Equals(PREP_SUCCESS));
+
+                Assert::That(directory_exists(build), !Equals(PREP_SUCCESS));
+            }
+
+            Assert::That(directory_empty(trash), Equals(PREP_FAILURE));
+
+            remove_directory(trash);
+
+            Assert::That(move_to_trash(build, trash), Equals(PREP_FAILURE));
+
+            remove_directory(path);
+        });
+
+        it("adds up the space a directory takes", []() {
+            auto path = make_temp_dir();
+
+            uint64_t empty = 0, bytes = 0, available = 0;
+
+            Assert::That(disk_usage(path, empty), Equals(PREP_SUCCESS));
+
+            create_path(build_path(path, "sub"));
+
+            std::ofstream(build_path(path, "sub", "file")) << std::string(64 * 1024, 'x');
+
+            Assert::That(disk_usage(path, bytes), Equals(PREP_SUCCESS));
+
+            Assert::That(bytes, IsGreaterThanOrEqualTo(empty + 64 * 1024));
+
+            Assert::That(free_space(path, available), Equals(PREP_SUCCESS));
+
+            Assert::That(available, IsGreaterThan(0U));
+
+            Assert::That(disk_usage(build_path(path, "missing"), bytes), Equals(PREP_FAILURE));
+
+            remove_directory(path);
+        });
+
+        it("remembers paths until they are invalidated", []() {
+            auto path = make_temp_dir();
+
+            auto dir = build_path(path, "dir");
+            auto sub = build_path(dir, "sub");
+
+            Assert::That(directory_exists(sub), !Equals(PREP_SUCCESS));
+
+            auto before = stat_counts();
+
+            Assert::That(directory_exists(sub), !Equals(PREP_SUCCESS));
+
+            Assert::That(stat_counts().hits, Equals(before.hits + 1));
+
+            // made behind the cache, still missing until invalidated
+            Assert::That(mkdir(dir.c_str(), S_IRWXU), Equals(0));
+            Assert::That(mkdir(sub.c_str(), S_IRWXU), Equals(0));
+
+            Assert::That(directory_exists(sub), !Equals(PREP_SUCCESS));
+
+            invalidate(dir);
+
+            Assert::That(directory_exists(sub), Equals(PREP_SUCCESS));
+
+            Assert::That(remove_directory(dir), Equals(PREP_SUCCESS));
+
+            Assert::That(directory_exists(sub), !Equals(PREP_SUCCESS));
+
+            Assert::That(create_path(sub), Equals(PREP_SUCCESS));
+
+            Assert::That(directory_exists(sub), Equals(PREP_SUCCESS));
+
+            remove_directory(path);
+        });
+    });
+
+    describe("walk", []() {
+        using namespace prep;
+
+        it("enters a folder before what is in it and leaves after", []() {
+            auto path = filesystem::make_temp_dir();
+
+            for (int i = 0; i < 50; i++) {
+                auto dir = filesystem::build_path(path, std::to_string(i % 5), std::to_string(i));
+
+                filesystem::create_path(dir);
+
+                std::ofstream(filesystem::build_path(dir, "file")) << i << "\n";
+            }
+
+            std::mutex mutex;
+            std::set<std::string> entered, left;
+            size_t files = 0;
+            bool ordered = true;
+
+            walk::Options options;
+
+            options.threads = 4;
+
+            options.enter = [&](const walk::Entry &entry) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ordered = ordered && (entry.depth == 0 || entered.count(entry.folder) == 1);
+                entered.insert(entry.path());
+                return walk::NEXT;
+            };
+
+            options.file = [&](const walk::Entry &entry) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ordered = ordered && entry.type == DT_REG && entered.count(entry.folder) == 1 &&
+                          left.count(entry.folder) == 0;
+                files++;
+                return walk::NEXT;
+            };
+
+            options.leave = [&](const walk::Entry &entry) {
+                std::lock_guard<std::mutex> lock(mutex);
+                left.insert(entry.path());
+                return walk::NEXT;
+            };
+
+            Assert::That(walk::tree(path, options), Equals(PREP_SUCCESS));
+
+            Assert::That(ordered, IsTrue());
+            Assert::That(files, Equals(50));
+            // the root, five folders and fifty below them
+            Assert::That(entered.size(), Equals(56));
+            Assert::That(left.size(), Equals(56));
+
+            filesystem::remove_directory(path);
+        });
+
+        it("can be stopped", []() {
+            auto path = filesystem::make_temp_dir();
+
+            for (int i = 0; i < 10; i++) {
+                std::ofstream(filesystem::build_path(path, std::to_string(i))) << i << "\n";
+            }
+
+            size_t files = 0;
+
+            walk::Options options;
+
+            options.file = [&files](const walk::Entry &entry) {
+                files++;
+                return walk::STOP;
+            };
+
+            Assert::That(walk::tree(path, options), Equals(PREP_FAILURE));
+
+            Assert::That(files, Equals(1));
+
+            Assert::That(filesystem::directory_empty(path), Equals(PREP_FAILURE));
+
+            filesystem::remove_directory(path);
+        });
     });
 
     describe("io", []() {
+        using namespace prep::io;
 
         it("can read a file descriptor", []() {
+            int fds[2];
+
+            Assert::That(pipe(fds), Equals(0));
+
+            write(fds[1], "first\r\nsecond\n\nthird");
+
+            close(fds[1]);
+
+            LineReader reader(fds[0], 4);
+            std::vector<std::string> lines;
+            std::string line;
+            ssize_t n;
+
+            do {
+                n = reader.fill();
+
+                while (reader.next(line)) {
+                    lines.push_back(line);
+                }
+            } while (n > 0);
+
+            close(fds[0]);
+
+            Assert::That(lines, Equals(std::vector<std::string>({"first", "second", "", "third"})));
+        });
+
+        it("can batch lines to a file descriptor", []() {
+            int fds[2];
 
+            Assert::That(pipe(fds), Equals(0));
+
+            LineWriter writer(fds[1], 1024);
+
+            writer.write_line("first");
+            writer.write_line("second");
+
+            Assert::That(writer.empty(), Equals(false));
+
+            Assert::That(writer.flush(), Equals(13));
+
+            Assert::That(writer.empty(), Equals(true));
+
+            close(fds[1]);
+
+            char buf[32] = {0};
+
+            Assert::That(read(fds[0], buf, sizeof(buf) - 1), Equals(13));
+
+            close(fds[0]);
+
+            Assert::That(std::string(buf), Equals("first\nsecond\n"));
+        });
+
+        it("can seal a temporary file", []() {
+            int fd = temporary_file("prep-test");
+
+            Assert::That(fd > prep::process::RequestFileno, IsTrue());
+
+            Assert::That(write(fd, "hook\nEND\n"), Equals(9));
+
+            Assert::That(seal_file(fd), Equals(PREP_SUCCESS));
+
+            char buf[32] = {0};
+
+            Assert::That(read(fd, buf, sizeof(buf) - 1), Equals(9));
+
+            close(fd);
+
+            Assert::That(std::string(buf), Equals("hook\nEND\n"));
+        });
+    });
+
+    describe("elf", []() {
+        using namespace prep;
+
+        it("only reads the runpath of elf files", []() {
+            auto path = filesystem::build_path(filesystem::make_temp_dir(), "notelf");
+
+            std::ofstream f(path);
+
+            f << "\x7f" << "ELF but not really\n";
+
+            f.close();
+
+            std::string runpath;
+
+            Assert::That(elf::get_runpath(path, runpath), Equals(PREP_FAILURE));
+            Assert::That(elf::set_runpath(path, "/lib"), Equals(PREP_FAILURE));
+            Assert::That(elf::get_runpath(path + ".missing", runpath), Equals(PREP_ERROR));
+        });
+    });
+
+    describe("relocate", []() {
+        using namespace prep;
+
+        auto write_file = [](const std::string &path, const std::string &data) {
+            std::ofstream(path, std::ios::binary) << data;
+        };
+
+        auto read_file = [](const std::string &path) {
+            std::ifstream in(path, std::ios::binary);
+
+            return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        };
+
+        const std::string nul(1, '\0');
+
+        it("replaces a prefix in a text file", [&write_file, &read_file]() {
+            auto path = filesystem::build_path(filesystem::make_temp_dir(), "prep.pc");
+
+            write_file(path, "prefix=/x/.prep\nlibs=/x/.prep/lib:/x/.prep2/lib\n");
+
+            Assert::That(relocate::rewrite_file(path, "/x/.prep", "/usr/local"), Equals(PREP_SUCCESS));
+
+            Assert::That(read_file(path), Equals("prefix=/usr/local\nlibs=/usr/local/lib:/x/.prep2/lib\n"));
+        });
+
+        it("pads a shorter prefix in a binary file", [&write_file, &read_file, &nul]() {
+            auto path = filesystem::build_path(filesystem::make_temp_dir(), "libprep.so");
+
+            write_file(path, "head" + nul + "/x/.prep/lib/libz.so" + nul + "tail");
+
+            Assert::That(relocate::rewrite_file(path, "/x/.prep", "/y"), Equals(PREP_SUCCESS));
+
+            // the rest of the string moves up and the difference is padded, nothing after it moves
+            Assert::That(read_file(path), Equals("head" + nul + "/y/lib/libz.so" + std::string(6, '\0') + nul + "tail"));
+        });
+
+        it("skips a longer prefix that starts with the prefix", [&write_file, &read_file, &nul]() {
+            auto path = filesystem::build_path(filesystem::make_temp_dir(), "libprep.so");
+
+            auto data = "head" + nul + "/x/.prep2/lib" + nul + "/x/.prepare" + nul;
+
+            write_file(path, data);
+
+            Assert::That(relocate::rewrite_file(path, "/x/.prep", "/y"), Equals(PREP_FAILURE));
+
+            Assert::That(read_file(path), Equals(data));
+        });
+
+        it("points a symbolic link at the new prefix", []() {
+            auto path = filesystem::make_temp_dir();
+
+            auto link = filesystem::build_path(path, "link");
+            auto other = filesystem::build_path(path, "other");
+
+            Assert::That(symlink("/x/.prep/lib/libz.so", link.c_str()), Equals(0));
+            Assert::That(symlink("/x/.prep2/lib/libz.so", other.c_str()), Equals(0));
+
+            relocate::Stats stats;
+
+            Assert::That(relocate::rewrite_tree(path, "/x/.prep", "/y", stats), Equals(PREP_SUCCESS));
+
+            Assert::That(stats.files, Equals(1U));
+
+            char buf[PATH_MAX] = {0};
+
+            Assert::That(readlink(link.c_str(), buf, sizeof(buf) - 1), Equals(14));
+            Assert::That(std::string(buf), Equals("/y/lib/libz.so"));
+
+            Assert::That(readlink(other.c_str(), buf, sizeof(buf) - 1), Equals(21));
+
+            filesystem::remove_directory(path);
+        });
+    });
+
+    describe("log file", []() {
+        using namespace prep;
+
+        it("can tail a compressed log", []() {
+            auto path = filesystem::build_path(filesystem::make_temp_dir(), "logs", "build.log.gz");
+
+            {
+                log::File file(path, false);
+
+                Assert::That(file.is_open(), IsTrue());
+
+                for (int i = 1; i <= 5; i++) {
+                    Assert::That(file.write_line("line " + std::to_string(i)), Equals(PREP_SUCCESS));
+                }
+            }
+
+            Assert::That(log::tail_file(path, 2), Equals(std::vector<std::string>({"line 4", "line 5"})));
+
+            {
+                log::File file(path, true);
+
+                file.write_line("line 6");
+            }
+
+            Assert::That(log::tail_file(path, 10).size(), Equals(6));
         });
     });
 
     describe("process", []() {
 
     });
+
+    describe("event loop", []() {
+        using namespace prep;
+
+        it("can wait on output and exit of a child", []() {
+            int fds[2];
+
+            Assert::That(pipe(fds), Equals(0));
+
+            pid_t pid = fork();
+
+            if (pid == 0) {
+                write(fds[1], "hi", 2);
+                _exit(3);
+            }
+
+            close(fds[1]);
+
+            EventLoop loop;
+            std::string output;
+            int code = -1;
+
+            loop.watch(fds[0], [&loop, &output](int fd) {
+                char buf[8] = {0};
+
+                if (read(fd, buf, sizeof(buf) - 1) <= 0) {
+                    loop.unwatch(fd);
+                    return;
+                }
+                output += buf;
+            });
+
+            loop.watch_child(pid, [&code](pid_t pid, int status) { code = WEXITSTATUS(status); });
+
+            while (!loop.empty()) {
+                Assert::That(loop.run_once(1000), IsGreaterThanOrEqualTo(0));
+            }
+
+            close(fds[0]);
+
+            Assert::That(output, Equals("hi"));
+            Assert::That(code, Equals(3));
+        });
+    });
+
+    describe("protocol", []() {
+        using namespace prep::protocol;
+
+        it("can parse frames split across reads", []() {
+            int fds[2];
+
+            Assert::That(pipe(fds), Equals(0));
+
+            Assert::That(write_request(fds[1], "resolve", {"multi\nline", ""}), Equals(PREP_SUCCESS));
+
+            close(fds[1]);
+
+            // a tiny buffer forces frames to span several reads
+            prep::io::LineReader reader(fds[0], 4);
+            Parser parser;
+            Frame frame;
+            std::vector<Frame> frames;
+            ssize_t n;
+
+            do {
+                n = reader.fill();
+
+                while (parser.next(reader, frame) == PREP_SUCCESS) {
+                    frames.push_back(frame);
+                }
+            } while (n > 0);
+
+            close(fds[0]);
+
+            Assert::That(frames.size(), Equals(4));
+            Assert::That(frames[0].type == Type::HOOK, IsTrue());
+            Assert::That(frames[0].payload, Equals("resolve"));
+            Assert::That(frames[1].payload, Equals("multi\nline"));
+            Assert::That(frames[2].payload, Equals(""));
+            Assert::That(frames[3].type == Type::END, IsTrue());
+        });
+
+        it("rejects a frame with a bad length", []() {
+            int fds[2];
+
+            Assert::That(pipe(fds), Equals(0));
+
+            prep::io::write(fds[1], "RETURN 3\nabcdef\n");
+
+            close(fds[1]);
+
+            prep::io::LineReader reader(fds[0]);
+            Parser parser;
+            Frame frame;
+
+            reader.fill();
+
+            Assert::That(parser.next(reader, frame), Equals(PREP_ERROR));
+
+            close(fds[0]);
+        });
+
+        it("can classify line commands", []() {
+            std::string_view args;
+
+            Assert::That(classify("return /tmp/source", args) == Command::RETURN, IsTrue());
+            Assert::That(std::string(args), Equals("/tmp/source"));
+
+            Assert::That(classify("DONE", args) == Command::DONE, IsTrue());
+            Assert::That(args.empty(), IsTrue());
+
+            Assert::That(classify("ECHO hello", args) == Command::LOG, IsTrue());
+            Assert::That(classify("EMIT", args) == Command::EMIT, IsTrue());
+            Assert::That(classify("[ 42%] Building", args) == Command::NONE, IsTrue());
+            Assert::That(classify("RET", args) == Command::NONE, IsTrue());
+            Assert::That(classify("", args) == Command::NONE, IsTrue());
+        });
+    });
+
+    describe("plugin", []() {
+        using namespace prep;
+
+        // makes a resolver plugin running a shell script
+        auto make_plugin = [](const std::string &manifest, const std::string &script) {
+            auto path = filesystem::make_temp_dir();
+
+            std::ofstream(filesystem::build_path(path, Plugin::MANIFEST_FILE)) << manifest;
+
+            auto main = filesystem::build_path(path, "main");
+
+            std::ofstream(main) << "#!/bin/sh\nread hook\n"
+                                << "while read line; do [ \"$line\" = END ] && break; done\n" << script;
+
+            chmod(main.c_str(), S_IRWXU);
+
+            return path;
+        };
+
+        it("reads a plugin that is not a worker until it exits", [&make_plugin]() {
+            auto path = make_plugin(R"({"executable": "main", "version": "1", "type": "resolver"})",
+                                    "echo Done building\necho RETURN after\n");
+
+            Plugin plugin("done");
+
+            Assert::That(plugin.load(path), Equals(PREP_SUCCESS));
+
+            auto result = plugin.on_resolve("somewhere", path);
+
+            Assert::That(result.code, Equals(PREP_SUCCESS));
+
+            Assert::That(result.values, Contains("after"));
+
+            filesystem::remove_directory(path);
+        });
+
+        it("times out a plugin that keeps printing", [&make_plugin]() {
+            auto path = make_plugin(R"({"executable": "main", "version": "1", "type": "resolver", "timeout": 1})",
+                                    "[ \"$hook\" = resolve ] || exit 0\nyes busy\n");
+
+            Plugin plugin("busy");
+
+            Assert::That(plugin.load(path), Equals(PREP_SUCCESS));
+
+            auto result = plugin.on_resolve("somewhere", path);
+
+            Assert::That(result.code, Equals(process::TimedOut));
+
+            filesystem::remove_directory(path);
+        });
+
+        it("times out a plugin that closes its output and keeps running", [&make_plugin]() {
+            // stderr still open, then nothing open at all
+            for (auto close : {"exec >&-", "exec >&- 2>&-"}) {
+                auto path = make_plugin(R"({"executable": "main", "version": "1", "type": "resolver", "timeout": 1})",
+                                        std::string("[ \"$hook\" = resolve ] || exit 0\n") + close + "\nsleep 30\n");
+
+                Plugin plugin("closed");
+
+                Assert::That(plugin.load(path), Equals(PREP_SUCCESS));
+
+                auto result = plugin.on_resolve("somewhere", path);
+
+                Assert::That(result.code, Equals(process::TimedOut));
+
+                filesystem::remove_directory(path);
+            }
+        });
+    });
+
+    describe("repository", []() {
+        using namespace prep;
+
+        // a repository in the current folder linking packages with a mode
+        auto make_repo = [](const char *mode) {
+            std::ofstream(filesystem::build_path(Repository::LOCAL_REPO_NAME, Repository::CONFIG_FILE))
+                << R"({"link_mode": ")" << mode << R"("})";
+
+            Options opts{};
+
+            auto repo = std::make_shared<Repository>();
+
+            Assert::That(repo->initialize(opts), Equals(PREP_SUCCESS));
+
+            return repo;
+        };
+
+        // installs a package with a library and a header
+        auto make_package = [](const std::shared_ptr<Repository> &repo, const std::string &name) {
+            auto path = repo->get_install_path(name);
+
+            filesystem::create_path(filesystem::build_path(path, "lib"));
+            filesystem::create_path(filesystem::build_path(path, "include"));
+            filesystem::create_path(repo->get_meta_path(name));
+
+            std::ofstream(filesystem::build_path(path, "lib", "lib" + name + ".so")) << name << "\n";
+            std::ofstream(filesystem::build_path(path, "include", name + ".h")) << name << "\n";
+
+            return path;
+        };
+
+        auto read_file = [](const std::string &path) {
+            std::string value;
+
+            std::ifstream(path) >> value;
+
+            return value;
+        };
+
+        std::string cwd, path;
+
+        before_each([&cwd, &path]() {
+            char buf[PATH_MAX] = {0};
+
+            cwd = getcwd(buf, sizeof(buf));
+
+            path = filesystem::make_temp_dir();
+
+            Assert::That(chdir(path.c_str()), Equals(0));
+
+            filesystem::create_path(filesystem::build_path(path, Repository::LOCAL_REPO_NAME));
+        });
+
+        after_each([&cwd, &path]() {
+            Assert::That(chdir(cwd.c_str()), Equals(0));
+
+            filesystem::remove_directory(path);
+        });
+
+        it("can link and unlink a package with each mode", [&make_repo, &make_package, &read_file]() {
+            for (auto mode : {"symlink", "hardlink", "reflink", "copy"}) {
+                auto repo = make_repo(mode);
+
+                auto install = make_package(repo, "pkg");
+
+                auto from = filesystem::build_path(install, "lib", "libpkg.so");
+                auto to = filesystem::build_path(repo->get_lib_path(), "libpkg.so");
+
+                Assert::That(repo->link_directory(install), Equals(PREP_SUCCESS));
+
+                struct stat installed, linked;
+
+                Assert::That(stat(from.c_str(), &installed), Equals(0));
+                Assert::That(lstat(to.c_str(), &linked), Equals(0));
+
+                Assert::That(S_ISLNK(linked.st_mode), Equals(strcmp(mode, "symlink") == 0));
+                Assert::That(linked.st_ino == installed.st_ino, Equals(strcmp(mode, "hardlink") == 0));
+
+                Assert::That(read_file(to), Equals("pkg"));
+
+                Assert::That(repo->unlink_directory(install), Equals(PREP_SUCCESS));
+
+                Assert::That(lstat(to.c_str(), &linked), Equals(-1));
+
+                // the package itself is kept
+                Assert::That(read_file(from), Equals("pkg"));
+            }
+        });
+
+        it("can relink a package after the mode changes", [&make_repo, &make_package, &read_file]() {
+            std::string install;
+
+            for (auto mode : {"copy", "hardlink", "reflink", "symlink", "copy"}) {
+                auto repo = make_repo(mode);
+
+                install = make_package(repo, "pkg");
+
+                Assert::That(repo->link_directory(install), Equals(PREP_SUCCESS));
+
+                Assert::That(read_file(filesystem::build_path(repo->get_lib_path(), "libpkg.so")), Equals("pkg"));
+            }
+
+            auto repo = make_repo("hardlink");
+
+            Assert::That(repo->unlink_directory(install), Equals(PREP_SUCCESS));
+
+            Assert::That(filesystem::file_exists(filesystem::build_path(repo->get_lib_path(), "libpkg.so")),
+                         !Equals(PREP_SUCCESS));
+        });
+
+        for (auto mode : {"hardlink", "reflink", "copy"}) {
+            it(std::string("keeps files that are not linked from the package with ") + mode,
+               [mode, &make_repo, &make_package, &read_file]() {
+                   auto repo = make_repo(mode);
+
+                   auto first = make_package(repo, "first");
+                   auto second = make_package(repo, "second");
+
+                   Assert::That(repo->link_directory(first), Equals(PREP_SUCCESS));
+                   Assert::That(repo->link_directory(second), Equals(PREP_SUCCESS));
+
+                   auto mine = filesystem::build_path(repo->get_lib_path(), "libmine.so");
+
+                   std::ofstream(mine) << "mine\n";
+
+                   // a new version of the second package collides with the first and with a file of the user
+                   std::ofstream(filesystem::build_path(second, "lib", "libfirst.so")) << "second\n";
+                   std::ofstream(filesystem::build_path(second, "lib", "libmine.so")) << "second\n";
+
+                   Assert::That(repo->link_directory(second), Equals(PREP_FAILURE));
+                   Assert::That(repo->unlink_directory(second), Equals(PREP_FAILURE));
+
+                   Assert::That(read_file(filesystem::build_path(repo->get_lib_path(), "libfirst.so")), Equals("first"));
+                   Assert::That(read_file(mine), Equals("mine"));
+
+                   Assert::That(repo->unlink_directory(first), Equals(PREP_SUCCESS));
+
+                   Assert::That(read_file(mine), Equals("mine"));
+               });
+        }
+    });
+
+#ifdef HAVE_COROUTINES
+    describe("task", []() {
+        using namespace prep;
+
+        it("can await a callback", []() {
+            Callback<int>::callback later;
+
+            auto task = [](Callback<int>::callback &later) -> Task<int> {
+                auto now = co_await Callback<int>([](const Callback<int>::callback &done) { done(1); });
+
+                auto then = co_await Callback<int>([&later](const Callback<int>::callback &done) { later = done; });
+
+                co_return now + then;
+            }(later);
+
+            Assert::That(task.done(), IsFalse());
+
+            later(2);
+
+            Assert::That(task.done(), IsTrue());
+            Assert::That(task.get(), Equals(3));
+        });
+    });
+#endif
 });
@@ -0,0 +1,67 @@
+#include <fts.h>
+#include <fstream>
+#include <string>
+
+#include "bench.h"
+#include "common.h"
+#include "util.h"
+#include "walk.h"
+
+using namespace micrantha::prep;
+
+namespace {
+  constexpr const size_t FOLDERS = 200;
+  constexpr const size_t FILES = 50;
+
+  // an install tree of many small headers
+  std::string header_tree() {
+    auto path = filesystem::make_temp_dir();
+
+    for (size_t i = 0; i < FOLDERS; i++) {
+      auto dir = filesystem::build_path(path, "include", "dir" + std::to_string(i % 20), "sub" + std::to_string(i));
+
+      filesystem::create_path(dir);
+
+      for (size_t j = 0; j < FILES; j++) {
+        std::ofstream(filesystem::build_path(dir, "header" + std::to_string(j) + ".h")) << j;
+      }
+    }
+
+    return path;
+  }
+
+  // visiting every file of a tree with fts, versus walk::tree
+  bench::Benchmark walked("walk", []() {
+    auto path = header_tree();
+    size_t found = 0;
+
+    bench::report("fts (per tree)", bench::measure(10, [&]() {
+      char *const paths[] = {(char *const)path.c_str(), nullptr};
+
+      FTS *file_system = fts_open(paths, FTS_COMFOLLOW | FTS_NOCHDIR, nullptr);
+      FTSENT *entry = nullptr;
+
+      while ((entry = fts_read(file_system)) != nullptr) {
+        if (entry->fts_info == FTS_F) {
+          found++;
+        }
+      }
+
+      fts_close(file_system);
+    }) / 1000, "ms");
+
+    walk::Options options;
+
+    options.file = [&found](const walk::Entry &entry) {
+      found++;
+      return walk::NEXT;
+    };
+
+    bench::report("walk::tree (per tree)", bench::measure(10, [&]() { walk::tree(path, options); }) / 1000, "ms");
+
+    // keeps the loops from being optimized away
+    bench::report("found", found, "");
+
+    filesystem::remove_directory(path);
+  });
+}